@@ -11,9 +11,10 @@ The screen pages include:
 2. Flow Rate,
 3. Volume, 
 4. Flow/Volume Mode Selection, 
-5. Config: uL / rev, 
-6. Config: steps / rev,
-7. Return to System State.
+5. Config: Tubing Selection,
+6. Config: uL / rev, 
+7. Config: steps / rev,
+8. Return to System State.
 
 The modes are: 
 1. Menu Mode, 
@@ -24,6 +25,24 @@ Menu Mode allows the user to change pages or start the pump.
 Edit Mode allows the user to select which digit/property to change in the menu.
 Value Change Mode allows the user to increment or decrement the selected digit.
 
+Shortcuts (GESTURES): hold select to edit the home page value, double-click
+select to return to the home page, and hold start to prime until the button is
+released.
+While editing, holding select cancels the edit and restores the stored value.
+Storing a larger volume during a volume run tops that run up by the difference.
+On the tubing page, select opens a browse of the table with the encoder;
+select again applies the entry shown, and canceling keeps the stored one.
+With RATE_UNITS, turning the encoder on the home page cycles the flow rate
+display between uL/min, mL/min, mL/hr and uL/s.
+With OSC_MODE, the mode page also offers oscillation, which reverses every
+time the volume setting has been pumped.
+
+Build profiles (PUMP_PROFILE) strip what a dedicated station does not use:
+FULL keeps every page, FLOW drops the volume and mode pages and the stored
+volume, VOLUME drops the mode page and always dispenses by volume, and HEADLESS
+drops the LCD menu and is driven by single-letter commands on the software
+UART (see Serial_Command).
+
 
 NOTE: 
 
@@ -39,6 +58,11 @@ THIS IMPLEMENTATION DOES NOT IMPACT THE PRECISION OF VOLUME DISPENSED - ONLY VEL
 ROM Used : 
 RAM Used : 
 
+The profiles have not been measured against the IDE build report yet. A
+profile that does not fit can drop the optional features listed with the
+hardware parameters (TUBE_TABLES, RATE_UNITS, GESTURES, EE_VERIFY,
+REDRAW_SCHED, POW10_TABLE).
+
 This software is licensed under GPLv3 <http://www.gnu.org/licenses/>.
 Any modifications or distributions have to be licensed under GPLv3.
 No warranty of any kind and copyright holders cannot be held liable.
@@ -49,23 +73,145 @@ Copyright (c) 2021 Robert R. Puccinelli
 
 #include "../Padauk-Peripherals/system_settings.h"
 #include "../Padauk-Peripherals/pdk_lcd.h"
+#include "../Padauk-Peripherals/pdk_i2c.h"
 #include "../Padauk-Peripherals/pdk_math.h"
 #include "../Padauk-Peripherals/pdk_stepper.h"
-#include "../Padauk-Peripherals/pdk_button.h"
 #include "../Padauk-Peripherals/pdk_eeprom.h"
+#include "pump_core.h"
+#include "pump_uart.h"
+#include "pump_tmc.h"
 
 
 //=====================//
 // HARDWARE PARAMETERS //
 //=====================//
 
+// Build profile, one of the PROFILE_* values below
+#DEFINE PROFILE_FULL       0
+#DEFINE PROFILE_FLOW       1
+#DEFINE PROFILE_VOLUME     2
+#DEFINE PROFILE_HEADLESS   3
+#DEFINE PUMP_PROFILE       PROFILE_FULL
+
 // Button pin assignments
-#DEFINE active_inputs      button_active_b
 #DEFINE start_button       PB.1
 #DEFINE select_button      PB.3
 #DEFINE rotary_input1      PB.0
 #DEFINE rotary_input2      PB.2
 
+// Debounce in input scan ticks (~1 ms per tick). A new level on a settled input
+// is accepted once two scans in a row read it, so a single-sample glitch is
+// ignored; any further edges on that input are bounce until its hold-off
+// expires.
+#DEFINE enc_holdoff        2
+#DEFINE btn_holdoff        20
+
+// Gesture timing in gesture ticks (16 scan ticks, ~16 ms per tick)
+#DEFINE long_press_ticks   40
+#DEFINE double_click_ticks 20
+
+// Live rate changes step the applied rate by this much (uL/min) per step
+// boundary until the new setting is reached. 0 applies it in a single step.
+#DEFINE vel_ramp_step      20
+
+// Step timer registers that Stepper_Set_Vel loads. A running rate change is
+// computed into them by the main loop, copied out, and reloaded by the step
+// interrupt at the next step edge. They must name pdk_stepper's timer.
+#DEFINE step_tmr_scale     TM2S
+#DEFINE step_tmr_bound     TM2B
+
+// Optional inline flow sensor on PB.5 (Interrupt_Src0) trimming the rate in a
+// PI loop. flow_nl_per_pulse is the sensor K-factor per counted edge. The
+// simulated source counts steps instead and turns them into the pulses of a
+// pump that delivers flow_sim_nl_per_ul nL per commanded uL (1000 is exact).
+#DEFINE FLOW_SENSOR        0
+#DEFINE FLOW_SENSOR_SIM    0
+#DEFINE flow_sensor        PB.5
+#DEFINE flow_nl_per_pulse  250
+#DEFINE flow_sim_nl_per_ul 940
+#DEFINE flow_kp_shift      2
+#DEFINE flow_ki_shift      4
+
+// Optional gravimetric calibration against a SICS balance on the software
+// UART. Pressing start on UNITS_PAGE dispenses cal_revs revolutions and sets
+// uL/rev from the weighed mass, taking 1 mg as 1 uL (water). The balance is
+// read cal_settle_ticks gesture ticks (~16 ms) after the run, and a reply may
+// take cal_reply_tries UART_Read_Byte waits (~0.15 s each).
+#DEFINE GRAV_CAL           0
+#DEFINE cal_revs           10
+#DEFINE cal_settle_ticks   125
+#DEFINE cal_reply_tries    50
+
+// Optional TMC-style driver configured over its single-wire UART. The run
+// current is chosen at each start: tmc_irun_high above tmc_boost_rate uL/min.
+#DEFINE TMC_UART           0
+#DEFINE tmc_irun_low       16
+#DEFINE tmc_irun_high      24
+#DEFINE tmc_boost_rate     5000
+
+// Optional stall detection from the driver DIAG output (active high), sampled
+// on every step. STALL_SIM raises DIAG after stall_sim_steps steps of a run.
+#DEFINE STALL_DETECT       0
+#DEFINE STALL_SIM          0
+#DEFINE stall_diag         PA.6
+#DEFINE stall_sim_steps    2000
+
+// Tubing wear: uL/rev falls by wear_per_krev / 65536 for every 1024 tube
+// revolutions, up to wear_max_loss / 65536. 0 disables the model.
+#DEFINE wear_per_krev      3
+#DEFINE wear_max_loss      13107
+
+// Fastest step rate (steps/s) the stepper timer produces reliably. Flow rates
+// above what this allows with the current steps/rev and uL/rev are refused.
+#DEFINE max_steps_per_sec  2000
+
+// Fastest step rate (steps/s) at which a counted run (volume or oscillation)
+// still reads the software UART. A received frame masks interrupts for ~1 ms,
+// so a step period must be longer; lines sent during a faster run are lost.
+#DEFINE serial_max_steps   800
+
+// Verify passes that may still find a mismatch before the EEPROM error is set
+#DEFINE eeprom_retries     3
+
+// Display power saving, in seconds without input (~1.024 s each). The
+// backlight goes off first, then the display. The backlight is the PCF8574
+// backpack bit; every LCD write sets it again, so it is cleared after each.
+#DEFINE bl_off_secs        30
+#DEFINE disp_off_secs      120
+
+// Seconds without input before a changed home page rate unit is stored
+#DEFINE units_save_secs    3
+
+// Optional oscillation mode: runs at the set rate and reverses every time the
+// volume setting (uL) has been pumped. Needs a profile with the mode page.
+#DEFINE OSC_MODE           0
+
+// Optional input and state trace in a RAM ring, dumped with the serial T
+// command. UI builds only answer T; the full command set stays headless.
+// It shares the software UART with GRAV_CAL, so the two cannot be combined.
+// The ring keeps trace_entries events at 3 bytes of RAM each, stamped with a
+// ~64 ms clock that wraps after ~70 minutes.
+#DEFINE TRACE              0
+#DEFINE trace_entries      12
+
+// Minimum time between redraws in gesture ticks (~16 ms per tick)
+#DEFINE frame_min_ticks    4
+
+// Optional features that cost ROM in every profile. Turn them off when a
+// profile does not fit.
+// TUBE_TABLES  : tubing page picking uL/rev from a table of common tubing
+// RATE_UNITS   : home page flow rate in selectable units
+// GESTURES     : hold and double-click select, hold start to prime
+// EE_VERIFY    : read-back verify of committed settings, with retries
+// REDRAW_SCHED : coalesced, rate-capped redraws; off redraws on every change
+// POW10_TABLE  : digit place values from ROM tables; off multiplies them out
+#DEFINE TUBE_TABLES        1
+#DEFINE RATE_UNITS         1
+#DEFINE GESTURES           1
+#DEFINE EE_VERIFY          1
+#DEFINE REDRAW_SCHED       1
+#DEFINE POW10_TABLE        1
+
 // Default values on first initialization
 #DEFINE def_steps_per_rev  800
 #DEFINE def_ul_per_rev     230
@@ -80,6 +226,9 @@ Copyright (c) 2021 Robert R. Puccinelli
 #DEFINE ADDR_VOLUME        0x12
 #DEFINE ADDR_VELOCITY      0x16
 #DEFINE ADDR_DIR           0x20
+#DEFINE ADDR_TUBE          0x24
+#DEFINE ADDR_TUBE_REVS     0x28
+#DEFINE ADDR_RATE_UNITS    0x2C
 
 
 //====================//
@@ -93,14 +242,53 @@ REV_ENTRY      => LCD_ENTRY_F | LCD_ENTRY_DEC_DDRAM | LCD_ENTRY_DDRAM_SHIFT
 FWD_ENTRY      => LCD_ENTRY_F | LCD_ENTRY_INC_DDRAM | LCD_ENTRY_DDRAM_SHIFT
 LCD_END        => LCD_WIDTH + LCD_L2 - 1
 RETURN_COL     => LCD_WIDTH - 1
+LCD_dot        => 0x2E
+
+// Input pins, pulled up and scanned by the T16 interrupt
+INPUT_PINS     => _FIELD(start_button) | _FIELD(select_button) | _FIELD(rotary_input1) | _FIELD(rotary_input2)
+
+// T16 counts SYSCLK / 4 (1 MHz) and interrupts every 1024 counts on bit 9.
+// Each scan moves the counter on by SCAN_T16_SKIP for a tick of about 1 ms.
+SCAN_T16_SKIP  => 24
+
+// Features kept by the build profile
+#DEFINE HAS_FLOW   (PUMP_PROFILE != PROFILE_VOLUME)
+#DEFINE HAS_VOLUME (PUMP_PROFILE != PROFILE_FLOW)
+#DEFINE HAS_UI     (PUMP_PROFILE != PROFILE_HEADLESS)
+#DEFINE SERIAL_CMD (PUMP_PROFILE == PROFILE_HEADLESS)
+#DEFINE SERIAL_RX  (SERIAL_CMD || TRACE)
+
+#IF TRACE && GRAV_CAL
+#ERROR TRACE and GRAV_CAL both need the software UART
+#ENDIF
+#DEFINE HAS_OSC    (OSC_MODE && HAS_FLOW && HAS_VOLUME)
+#DEFINE HAS_RATE_UNITS (RATE_UNITS && HAS_UI && HAS_FLOW)
+#DEFINE HAS_TUBES  (TUBE_TABLES && HAS_UI)
 
 // EEPROM first save
 #DEFINE EEPROM_INIT_VAL 132
 
 // Enumerations for state machine, mode, and eeprom operations
 ENUM {MENU_MODE, EDIT_MODE, VALUE_MODE};
-ENUM {HOME_PAGE, FLOW_PAGE, VOL_PAGE, MODE_PAGE, UNITS_PAGE, EXIT_PAGE};
-ENUM {INIT, STEPS_REV, UNITS_REV, VOL, VEL, DIR};
+#IF HAS_FLOW && HAS_VOLUME
+ENUM {HOME_PAGE, FLOW_PAGE, VOL_PAGE, MODE_PAGE, TUBE_PAGE, UNITS_PAGE, EXIT_PAGE};
+#ELSE
+#IF HAS_VOLUME
+ENUM {HOME_PAGE, FLOW_PAGE, VOL_PAGE, TUBE_PAGE, UNITS_PAGE, EXIT_PAGE};
+#ELSE
+ENUM {HOME_PAGE, FLOW_PAGE, TUBE_PAGE, UNITS_PAGE, EXIT_PAGE};
+#ENDIF
+#ENDIF
+ENUM {INIT, STEPS_REV, UNITS_REV, VOL, VEL, DIR, TUBE, TUBE_REVS, RATE_UNITS};
+
+// Home page flow rate units, cycled with the encoder on the home page
+ENUM {RATE_UL_MIN, RATE_ML_MIN, RATE_ML_HR, RATE_UL_S, RATE_UNIT_COUNT};
+
+// Trace ring size in bytes, three per event
+#DEFINE TRACE_BYTES     (trace_entries * 3)
+
+// Number of entries in the tubing tables
+#DEFINE TUBE_COUNT      6
 
 
 //==================//
@@ -110,6 +298,28 @@ ENUM {INIT, STEPS_REV, UNITS_REV, VOL, VEL, DIR};
 // General Purpose
 STATIC WORD  temp_data     = 0;
 STATIC DWORD temp_data2    = 0;
+STATIC DWORD long_num      = 0;
+
+// Overlays: each alias shares storage with a variable never live at the same
+// time. temp_data and temp_data2 are main-loop scratch that no call preserves.
+// cal_*        : only inside Read_Balance_Mass and the uL/rev division after it;
+//                cal_tries is spent before Long_Divide takes long_num
+// stall_steps  : written with Stepper_Stop, read once by Compute_Stall_Volume;
+//                stall_volume is only shown while stalled, cleared on start
+// serial_*     : only inside Serial_Command, whose store path uses temp_data2
+// snap_data    : consumed right after the Snap_* call that fills it
+// topup_steps  : input_data is spent once the value is stored
+// output_char  : only between Display_Digits and the Display_Digit it calls
+#DEFINE cal_mass           temp_data2
+#DEFINE cal_index          temp_data$0
+#DEFINE cal_decimals       temp_data$1
+#DEFINE cal_tries          long_num$0
+#DEFINE stall_steps        stall_volume
+#DEFINE serial_cmd         temp_data$0
+#DEFINE serial_screen      temp_data$1
+#DEFINE snap_data          temp_data2
+#DEFINE topup_steps        input_data
+#DEFINE output_char        temp_data2$0
 
 // State machine
 STATIC BYTE  curr_state    = MENU_MODE;
@@ -121,11 +331,144 @@ STATIC BYTE  next_screen   = HOME_PAGE;
 STATIC BYTE  col_index     = 0;
 STATIC BYTE  col_data_s    = 0;
 STATIC DWORD input_data    = 0;
-STATIC BYTE  output_char   = 0;
 STATIC BYTE  line_buffer   [LCD_WIDTH];
 
+// Home page rate units. disp_point is the number of decimals Display_Digits
+// places.
+#IF HAS_RATE_UNITS
+STATIC BYTE  rate_units    = RATE_UL_MIN;
+#ENDIF
+STATIC BYTE  disp_point    = 0;
+
+// Range of the field being edited, loaded by Load_Field_Range
+STATIC WORD  edit_min      = 1;
+STATIC DWORD edit_max      = 0xFFFF;
+
 // EEPROM
 STATIC BYTE  eeprom_buff   [5];
+STATIC BYTE  eeprom_flags  = 0;
+STATIC BIT   ee_error      : eeprom_flags.?;
+#IF EE_VERIFY
+STATIC BIT   ee_verify     : eeprom_flags.?;
+STATIC BYTE  ee_retry_cnt  = 0;
+#ENDIF
+
+// Tubing
+#IF HAS_TUBES
+STATIC BYTE  tube_index    = 0;
+STATIC BYTE  tube_browse   = 0;
+#ENDIF
+STATIC WORD  tube_units_per_rev = 0;
+STATIC BYTE  tube_units_frac    = 0;
+STATIC DWORD tube_revs     = 0;
+STATIC WORD  rev_steps     = 0;
+
+// Stepper
+STATIC WORD  vel_applied   = 0;
+STATIC WORD  vel_target    = 0;
+STATIC BYTE  vel_scale     = 0;
+STATIC BYTE  vel_bound     = 0;
+STATIC DWORD run_steps     = 0;
+STATIC WORD  run_units     = 0;
+STATIC BYTE  run_shift     = 0;
+STATIC DWORD steps_left    = 0;
+#IF HAS_OSC
+STATIC DWORD osc_half      = 0;
+#ENDIF
+#IF SERIAL_RX
+STATIC WORD  rx_max_rate   = 0;
+#ENDIF
+
+// Stall detection
+#IF STALL_DETECT
+STATIC DWORD stall_volume  = 0;
+STATIC BYTE  stall_flags   = 0;
+STATIC BIT   stall_pending : stall_flags.?;
+STATIC BIT   stalled       : stall_flags.?;
+#IF STALL_SIM
+STATIC WORD  stall_sim_cnt = 0;
+#ENDIF
+#ENDIF
+
+// Flow sensor
+#IF FLOW_SENSOR
+STATIC WORD  flow_pulses   = 0;
+STATIC WORD  flow_window   = 0;
+STATIC WORD  flow_integral = 0x8000;
+#IF FLOW_SENSOR_SIM
+STATIC WORD  flow_sim_ul_rem = 0;
+STATIC WORD  flow_sim_nl_rem = 0;
+#ENDIF
+#ENDIF
+
+// Gravimetric calibration
+#IF GRAV_CAL
+STATIC BYTE  cal_flags     = 0;
+STATIC BIT   cal_active    : cal_flags.?;
+STATIC BIT   cal_dist_mode : cal_flags.?;
+STATIC BIT   cal_point     : cal_flags.?;
+STATIC BIT   cal_error     : cal_flags.?;
+STATIC BIT   cal_settling  : cal_flags.?;
+STATIC BYTE  cal_settle    = 0;
+#ENDIF
+
+// Presses latched by the input scan and consumed by Process_Inputs
+STATIC BYTE  active_inputs  = 0;
+
+// Input scan (interrupt context only)
+STATIC WORD  scan_count     = 0;
+STATIC BYTE  input_sample   = 0;
+STATIC BYTE  input_prev     = 0;
+STATIC BYTE  input_changed  = 0;
+STATIC BYTE  input_stable   = 0;
+STATIC BYTE  holdoff_rot1   = 0;
+STATIC BYTE  holdoff_rot2   = 0;
+STATIC BYTE  holdoff_start  = 0;
+STATIC BYTE  holdoff_select = 0;
+STATIC BYTE  gesture_div    = 0;
+#IF GESTURES
+STATIC BYTE  start_hold     = 0;
+STATIC BYTE  select_hold    = 0;
+STATIC BYTE  select_gap     = 0;
+#ENDIF
+#IF HAS_UI || FLOW_SENSOR
+STATIC BYTE  secs_div       = 0;
+#ENDIF
+
+// Seconds since the last input, saturating at 255. Cleared by the main loop.
+#IF HAS_UI
+STATIC BYTE  idle_secs      = 0;
+STATIC BYTE  power_flags    = 0;
+STATIC BIT   bl_off         : power_flags.?;
+STATIC BIT   disp_off       : power_flags.?;
+#ENDIF
+
+// Trace ring (main loop only, except trace_clock)
+#IF TRACE
+STATIC BYTE  trace_buf      [TRACE_BYTES];
+STATIC WORD  trace_ptr      = 0;
+STATIC BYTE  trace_head     = 0;
+STATIC BYTE  trace_event    = 0;
+STATIC WORD  trace_clock    = 0;
+#ENDIF
+
+// Gestures, latched by the input scan and consumed by Process_Inputs
+STATIC BYTE  gesture_inputs  = 0;
+STATIC BIT   gest_long_sel   : gesture_inputs.0;
+STATIC BIT   gest_double     : gesture_inputs.1;
+STATIC BIT   gest_long_start : gesture_inputs.2;
+STATIC BIT   gest_start_up   : gesture_inputs.3;
+
+// select_defer is set by the main loop on pages where a select press has side
+// effects; the input scan then holds the press in select_owed until the
+// double-click gap expires without a second press or a long press.
+// sel_opened_edit marks an edit opened by the select press still held.
+#IF GESTURES
+STATIC BYTE  select_flags    = 0;
+STATIC BIT   select_defer    : select_flags.?;
+STATIC BIT   select_owed     : select_flags.?;
+STATIC BIT   sel_opened_edit : select_flags.?;
+#ENDIF
 
 // Flags
 STATIC BYTE  pump_flags     = 0;
@@ -136,13 +479,231 @@ STATIC BIT   shift_r_flag   : pump_flags.?;
 STATIC BIT   update_display : pump_flags.?;
 STATIC BIT   dir_sign       : pump_flags.?;
 STATIC BIT   init_flag      : pump_flags.?;
+STATIC BIT   priming        : pump_flags.?;
+
+// Bits are set and cleared singly, so the stepper interrupt and the main loop
+// can share this byte
+STATIC BYTE  run_flags      = 0;
+STATIC BIT   vel_pending    : run_flags.?;
+STATIC BIT   vel_staged     : run_flags.?;
+STATIC BIT   flow_ready     : run_flags.?;
+STATIC BIT   render_pending : run_flags.?;
+STATIC BIT   osc_mode       : run_flags.?;
+STATIC BIT   osc_active     : run_flags.?;
+STATIC BIT   osc_home_dir   : run_flags.?;
+
+// Gesture ticks until the next redraw is allowed (decremented by the input scan)
+#IF REDRAW_SCHED
+STATIC BYTE  frame_wait     = 0;
+#ENDIF
+
+// Value line redraw request, for changes that leave the rest of the page as is
+#IF HAS_UI
+STATIC BYTE  disp_flags     = 0;
+STATIC BIT   line_pending   : disp_flags.?;
+STATIC BIT   units_unsaved  : disp_flags.?;
+#ENDIF
+
+STATIC BYTE  gesture_flags    = 0;
+STATIC BIT   long_select_flag : gesture_flags.0;
+STATIC BIT   double_flag      : gesture_flags.1;
+STATIC BIT   prime_flag       : gesture_flags.2;
+STATIC BIT   prime_end_flag   : gesture_flags.3;
+STATIC BIT   prime_dist_mode  : gesture_flags.4;
 
 
 //==================//
 // STATIC FUNCTIONS //
 //==================//
 
+// TUBING TABLES
+
+// Nominal L/S 13, 14, 16, 25, 17 and 18 tubing, indexed by A: inner diameter
+// (um) and displacement (uL/rev), one byte per table. Calibrate for dosing.
+#IF HAS_TUBES
+static void Tube_ID_Lo(void)
+{
+	pcadd A;
+	ret 0x20;	//  800 um
+	ret 0x40;	// 1600 um
+	ret 0x1C;	// 3100 um
+	ret 0xC0;	// 4800 um
+	ret 0x00;	// 6400 um
+	ret 0xDC;	// 7900 um
+}
+
+
+static void Tube_ID_Hi(void)
+{
+	pcadd A;
+	ret 0x03;
+	ret 0x06;
+	ret 0x0C;
+	ret 0x12;
+	ret 0x19;
+	ret 0x1E;
+}
+
+
+static void Tube_Units_Lo(void)
+{
+	pcadd A;
+	ret 0x3C;	//   60 uL/rev
+	ret 0xD2;	//  210 uL/rev
+	ret 0x20;	//  800 uL/rev
+	ret 0xA4;	// 1700 uL/rev
+	ret 0xF0;	// 2800 uL/rev
+	ret 0xD8;	// 3800 uL/rev
+}
+
+
+static void Tube_Units_Hi(void)
+{
+	pcadd A;
+	ret 0x00;
+	ret 0x00;
+	ret 0x03;
+	ret 0x06;
+	ret 0x0A;
+	ret 0x0E;
+}
+#ENDIF
+
+
+// DIGIT TABLES
+#IF HAS_UI && POW10_TABLE
+
+// Place value of an edited digit, 10^A for A = 0..7, one byte per table
+static void Pow10_B0(void)
+{
+	pcadd A;
+	ret 0x01;
+	ret 0x0A;
+	ret 0x64;
+	ret 0xE8;
+	ret 0x10;
+	ret 0xA0;
+	ret 0x40;
+	ret 0x80;
+}
+
+
+static void Pow10_B1(void)
+{
+	pcadd A;
+	ret 0x00;
+	ret 0x00;
+	ret 0x00;
+	ret 0x03;
+	ret 0x27;
+	ret 0x86;
+	ret 0x42;
+	ret 0x96;
+}
+
+
+static void Pow10_B2(void)
+{
+	pcadd A;
+	ret 0x00;
+	ret 0x00;
+	ret 0x00;
+	ret 0x00;
+	ret 0x00;
+	ret 0x01;
+	ret 0x0F;
+	ret 0x98;
+}
+#ENDIF
+
+
+// MATH OPERATIONS
+
+// long_num /= math_divisor (16-bit), remainder in math_remainder. eword_divide
+// only takes 24 bits, so the top three bytes go first and the low byte second.
+static void Long_Divide(void)
+{
+	math_dividend$0 = long_num$1;
+	math_dividend$1 = long_num$2;
+	math_dividend$2 = long_num$3;
+	eword_divide();
+	long_num$3 = math_quotient$2;
+	long_num$2 = math_quotient$1;
+	long_num$1 = math_quotient$0;
+
+	math_dividend$0 = long_num$0;
+	math_dividend$1 = math_remainder$0;
+	math_dividend$2 = math_remainder$1;
+	eword_divide();
+	long_num$0 = math_quotient$0;
+}
+
+
+// uL/min for math_mult_b steps/s (up to 4369) at the applied uL/rev, in
+// long_num (max 0xFFFF). Rounded down to a multiple of 4, so never above it.
+static void Steps_To_Rate(void)
+{
+	// A quarter of the rate: steps/s * 15 * uL/rev / steps/rev
+	math_mult_b = (math_mult_b << 4) - math_mult_b;
+	math_mult_a = stepper_units_per_rev;
+	word_multiply();
+	long_num = math_product;
+	math_divisor  = stepper_steps_per_rev;
+	Long_Divide();
+	if (long_num > 0x3FFF) long_num = 0xFFFF;
+	else long_num <<= 2;
+}
+
+
+// FIELD RANGES
+
+// Field limits for next_screen; the rate is also capped at max_steps_per_sec
+static void Load_Field_Range(void)
+{
+	edit_min = 1;
+	edit_max = 0xFFFF;
+#IF HAS_VOLUME
+	if (next_screen == VOL_PAGE) edit_max = 0xFFFFFF;
+#ENDIF
+	if ((next_screen == FLOW_PAGE) && stepper_steps_per_rev)
+	{
+		math_mult_b = max_steps_per_sec;
+		Steps_To_Rate();
+		edit_max = long_num;
+		if (edit_max < edit_min) edit_max = edit_min;
+	}
+}
+
+
+#IF HAS_RATE_UNITS
+// RATE DISPLAY
+
+// Flow rate in the home page units into input_data, with disp_point decimals;
+// uL/s is rounded as (uL/min * 10 + 3) / 6
+static void Compute_Rate_Display(void)
+{
+	input_data = stepper_units_per_min;
+
+	if (rate_units == RATE_ML_MIN) disp_point = 3;
+	elseif (rate_units == RATE_ML_HR)
+	{
+		input_data = (input_data << 2) + (input_data << 1);
+		disp_point = 2;
+	}
+	elseif (rate_units == RATE_UL_S)
+	{
+		math_dividend = (input_data << 3) + (input_data << 1) + 3;
+		math_divisor  = 6;
+		eword_divide();
+		input_data = math_quotient;
+		disp_point = 2;
+	}
+}
+#ENDIF
+
+
 // LCD OPERATIONS
+#IF HAS_UI
 static void Display_Digit(void)
 {
 	switch (output_char)
@@ -181,13 +742,19 @@ static void Display_Digits(void)
 	math_dividend = input_data;
 	math_divisor  = 10;
 
-	while(math_dividend > 0)
+	// At least one digit left of the decimal point
+	while((math_dividend > 0) || (temp_data$0 <= disp_point))
 	{
 		eword_divide();
 		math_dividend = math_quotient;
 		output_char = math_remainder;
 		Display_Digit();
 		temp_data$0++;
+		if (disp_point && (temp_data$0 == disp_point))
+		{
+			lcd_trx_byte = LCD_dot;
+			LCD_Write_Byte();
+		}
 	}
 
 	while(temp_data$0 < temp_data$1)
@@ -216,67 +783,6 @@ static void Change_Dir_Sign(void)
 }
 
 
-static void Change_Value(void)
-{
-	temp_data$0 = RETURN_COL - col_index - 1;
-	temp_data$1 = temp_data$0;
-	math_dividend = input_data;
-	math_divisor = 10;
-
-	do 
-	{
-		eword_divide();
-		math_dividend = math_quotient;
-	}
-	while(temp_data$0--);
-	output_char = math_remainder;
-
-	if (shift_r_flag) 
-	{
-		output_char++;
-		if (output_char > 9) output_char = 0;
-	}
-	else
-	{
-		if (output_char == 0) output_char = 9;
-		else output_char--;
-	}
-
-	// Reconstruct new value since LCD cannot be read
-	math_mult_a = math_quotient;
-	math_mult_b = 10;
-	word_multiply();
-
-	temp_data2 = math_product + output_char;
-
-	math_mult_a = 1;
-	math_mult_b = 10;
-	math_product = 1;
-
-	while(temp_data$1)
-	{
-		math_mult_a = math_product;
-		word_multiply();
-		temp_data$1--;
-	}
-
-	math_mult_a = math_product;
-	math_mult_b = temp_data2;
-	word_multiply();
-
-	temp_data2 = math_product;
-
-	math_divisor = math_mult_a;
-	math_dividend = input_data;
-	eword_divide();
-
-	input_data = temp_data2 + math_remainder;
-
-	// Update digit on display
-	Display_Digit();
-}
-
-
 static void Clear_Line_Buffer (void)
 {
 	temp_data2$0 = 16;
@@ -288,6 +794,20 @@ static void Clear_Line_Buffer (void)
 	}
 }
 
+
+// Raw backpack write with every PCF8574 output low: backlight off and E idle,
+// so the HD44780 ignores it. It holds until the next LCD write.
+static void Backlight_Off(void)
+{
+	I2C_Start();
+	i2c_trx_byte = lcd_device_addr;
+	I2C_Write_Byte();
+	i2c_trx_byte = 0;
+	I2C_Write_Byte();
+	I2C_Stop();
+}
+
+
 static void Write_Line_Buffer (void)
 {
 	temp_data2$0 = 16;
@@ -316,6 +836,32 @@ static void Write_Data_Line (void)
 			lcd_trx_byte = LCD_U;
 			LCD_Write_Byte();
 		}
+#IF HAS_RATE_UNITS
+		elseif (rate_units == RATE_UL_S)
+		{
+			lcd_trx_byte = LCD_S;
+			LCD_Write_Byte();
+			lcd_trx_byte = LCD_slash;
+			LCD_Write_Byte();
+			lcd_trx_byte = LCD_L;
+			LCD_Write_Byte();
+			lcd_trx_byte = LCD_U;
+			LCD_Write_Byte();
+		}
+		elseif (rate_units == RATE_ML_HR)
+		{
+			lcd_trx_byte = LCD_R;
+			LCD_Write_Byte();
+			lcd_trx_byte = LCD_H;
+			LCD_Write_Byte();
+			lcd_trx_byte = LCD_slash;
+			LCD_Write_Byte();
+			lcd_trx_byte = LCD_L;
+			LCD_Write_Byte();
+			lcd_trx_byte = LCD_M;
+			LCD_Write_Byte();
+		}
+#ENDIF
 		else
 		{
 			lcd_trx_byte = LCD_N;
@@ -329,6 +875,9 @@ static void Write_Data_Line (void)
 			lcd_trx_byte = LCD_L;
 			LCD_Write_Byte();
 			lcd_trx_byte = LCD_U;
+#IF HAS_RATE_UNITS
+			if (rate_units == RATE_ML_MIN) lcd_trx_byte = LCD_M;
+#ENDIF
 			LCD_Write_Byte();
 		}
 	}
@@ -354,24 +903,84 @@ static void Write_Data_Line (void)
 }
 
 
+// Adds or subtracts the place value under the cursor, saturating at the range
+static void Change_Value(void)
+{
+	temp_data$0 = RETURN_COL - col_index - 1;
+	temp_data2 = 0x1000000;
+	if (temp_data$0 < 8)
+	{
+#IF POW10_TABLE
+		A = temp_data$0;
+		Pow10_B0();
+		temp_data2$0 = A;
+		A = temp_data$0;
+		Pow10_B1();
+		temp_data2$1 = A;
+		A = temp_data$0;
+		Pow10_B2();
+		temp_data2$2 = A;
+		temp_data2$3 = 0;
+#ELSE
+		temp_data2 = 1;
+		while (temp_data$0--) temp_data2 = (temp_data2 << 3) + (temp_data2 << 1);
+#ENDIF
+	}
+
+	if (shift_r_flag)
+	{
+		input_data += temp_data2;
+		if (input_data > edit_max) input_data = edit_max;
+	}
+	else
+	{
+		if (input_data < temp_data2 + edit_min) input_data = edit_min;
+		else input_data -= temp_data2;
+	}
+
+	// Carries can change any digit, so the whole value line is redrawn
+	line_pending = 1;
+}
+
+
 static void Render_Screen(void)
 {
 	LCD_Clear();
+	disp_point = 0;
 	switch (next_screen)
 	{
 		case HOME_PAGE : 
 			col_data_s = LCD_WIDTH - 1;
 			Clear_Line_Buffer();
-			line_buffer[0]  = LCD_P;
-			line_buffer[1]  = LCD_U;
-			line_buffer[2]  = LCD_M;
-			line_buffer[3]  = LCD_P;
+			if (ee_error)
+			{
+				line_buffer[0]  = LCD_E;
+				line_buffer[1]  = LCD_R;
+				line_buffer[2]  = LCD_R;
+			}
+			else
+			{
+				line_buffer[0]  = LCD_P;
+				line_buffer[1]  = LCD_U;
+				line_buffer[2]  = LCD_M;
+				line_buffer[3]  = LCD_P;
+			}
 
 			if(stepper_is_moving)
 			{
 				line_buffer[6] = LCD_O;
 				line_buffer[7] = LCD_N;
 			}
+#IF STALL_DETECT
+			elseif (stalled)
+			{
+				line_buffer[5] = LCD_S;
+				line_buffer[6] = LCD_T;
+				line_buffer[7] = LCD_A;
+				line_buffer[8] = LCD_L;
+				line_buffer[9] = LCD_L;
+			}
+#ENDIF
 			else
 			{
 				line_buffer[5] = LCD_O;
@@ -383,6 +992,10 @@ static void Render_Screen(void)
 			{
 				
 				input_data = stepper_units_per_run;
+#IF STALL_DETECT
+				// Undelivered volume of the stalled run
+				if (stalled) input_data = stall_volume;
+#ENDIF
 
 				line_buffer[10]  = LCD_V;
 				line_buffer[11]  = LCD_O;
@@ -393,12 +1006,29 @@ static void Render_Screen(void)
 			}
 			else
 			{
+#IF HAS_RATE_UNITS
+				Compute_Rate_Display();
+#ELSE
 				input_data = stepper_units_per_min;
-
+#ENDIF
+
+#IF HAS_OSC
+				if (osc_mode)
+				{
+					line_buffer[13]  = LCD_O;
+					line_buffer[14]  = LCD_S;
+					line_buffer[15]  = LCD_C;
+				}
+				else
+				{
+#ENDIF
 				line_buffer[12]  = LCD_F;
 				line_buffer[13]  = LCD_L;
 				line_buffer[14]  = LCD_O;
 				line_buffer[15]  = LCD_W;
+#IF HAS_OSC
+				}
+#ENDIF
 			}
 			break;
 
@@ -415,6 +1045,7 @@ static void Render_Screen(void)
 			line_buffer[5]  = LCD_N;
 			break;
 
+#IF HAS_VOLUME
 		case VOL_PAGE :
 			col_data_s = 6;
 			input_data = stepper_units_per_run;
@@ -428,10 +1059,12 @@ static void Render_Screen(void)
 			line_buffer[5]  = LCD_L;
 			line_buffer[6]  = LCD_para_r;
 			break;
+#ENDIF
 
+#IF HAS_FLOW && HAS_VOLUME
 		case MODE_PAGE :
 			Clear_Line_Buffer();
-			if (!stepper_dist_mode) line_buffer[0] = LCD_return;
+			if (!stepper_dist_mode && !osc_mode) line_buffer[0] = LCD_return;
 			line_buffer[1]  = LCD_F;
 			line_buffer[2]  = LCD_L;
 			line_buffer[3]  = LCD_O;
@@ -442,7 +1075,22 @@ static void Render_Screen(void)
 			LCD_Address_Set();
 
 			Clear_Line_Buffer();
-			if (stepper_dist_mode) line_buffer[0] = LCD_return;
+			if (stepper_dist_mode || osc_mode) line_buffer[0] = LCD_return;
+#IF HAS_OSC
+			if (osc_mode)
+			{
+				line_buffer[1]  = LCD_O;
+				line_buffer[2]  = LCD_S;
+				line_buffer[3]  = LCD_C;
+				line_buffer[4]  = LCD_I;
+				line_buffer[5]  = LCD_L;
+				line_buffer[6]  = LCD_L;
+				line_buffer[7]  = LCD_A;
+				line_buffer[8]  = LCD_T;
+				line_buffer[9]  = LCD_E;
+				break;
+			}
+#ENDIF
 			line_buffer[1]  = LCD_V;
 			line_buffer[2]  = LCD_O;
 			line_buffer[3]  = LCD_L;
@@ -450,10 +1098,38 @@ static void Render_Screen(void)
 			line_buffer[5]  = LCD_M;
 			line_buffer[6]  = LCD_E;
 			break;
+#ENDIF
+
+#IF HAS_TUBES
+		case TUBE_PAGE :
+			// Browsing shows tube_browse; otherwise it follows the stored entry
+			if (next_state == MENU_MODE) tube_browse = tube_index;
+			col_data_s = 11;
+			input_data = 0;
+			A = tube_browse;
+			Tube_ID_Lo();
+			input_data$0 = A;
+			A = tube_browse;
+			Tube_ID_Hi();
+			input_data$1 = A;
+
+			Clear_Line_Buffer();
+			line_buffer[0]  = LCD_T;
+			line_buffer[1]  = LCD_U;
+			line_buffer[2]  = LCD_B;
+			line_buffer[3]  = LCD_E;
+			line_buffer[5]  = LCD_I;
+			line_buffer[6]  = LCD_D;
+			line_buffer[7]  = LCD_para_l;
+			line_buffer[8]  = LCD_U;
+			line_buffer[9]  = LCD_M;
+			line_buffer[10] = LCD_para_r;
+			break;
+#ENDIF
 
 		case UNITS_PAGE :
 			col_data_s = 10;
-			input_data = stepper_units_per_rev;
+			input_data = tube_units_per_rev;
 
 			Clear_Line_Buffer();
 			line_buffer[0]  = LCD_U;
@@ -462,6 +1138,14 @@ static void Render_Screen(void)
 			line_buffer[3]  = LCD_R;
 			line_buffer[4]  = LCD_E;
 			line_buffer[5]  = LCD_V;
+#IF GRAV_CAL
+			if (cal_error)
+			{
+				line_buffer[13] = LCD_E;
+				line_buffer[14] = LCD_R;
+				line_buffer[15] = LCD_R;
+			}
+#ENDIF
 			break;
 
 		case EXIT_PAGE:			
@@ -473,106 +1157,591 @@ static void Render_Screen(void)
 			line_buffer[5]  = LCD_return;
 	}
 	Write_Line_Buffer();
+#IF HAS_FLOW && HAS_VOLUME
 	if ((next_screen != MODE_PAGE) && (next_screen != EXIT_PAGE)) Write_Data_Line();
+#ELSE
+	if (next_screen != EXIT_PAGE) Write_Data_Line();
+#ENDIF
 	
 }
+#ELSE
+// Headless builds have no display
+static void Render_Screen(void)
+{
+}
+#ENDIF
+
+
+// Screen changes only mark render_pending. With REDRAW_SCHED menu mode redraws
+// at most once per frame_min_ticks. Render_Screen loads input_data, so an edit
+// flushes as it opens and on its own changes, and background redraws wait for
+// the menu. Digit steps mark line_pending for the value line alone.
+static void Redraw(void)
+{
+	render_pending = 0;
+#IF HAS_UI
+	line_pending = 0;
+#ENDIF
+#IF REDRAW_SCHED
+	frame_wait = frame_min_ticks;
+#ENDIF
+	Render_Screen();
+#IF HAS_UI
+	// Background redraws must not light an idle display
+	if (bl_off) Backlight_Off();
+#ENDIF
+}
+
+
+#IF HAS_UI
+// Redraws only the value line and puts the cursor back on the edited digit
+static void Flush_Data_Line(void)
+{
+	line_pending = 0;
+#IF REDRAW_SCHED
+	frame_wait = frame_min_ticks;
+#ENDIF
+	Write_Data_Line();
+	lcd_trx_byte = LCD_L2 + col_index;
+	LCD_Address_Set();
+}
+#ENDIF
+
+
+// SNAPSHOT OPERATIONS
+
+// Copies of multi-byte interrupt counters, taken with interrupts masked
+static void Snap_Tube_Revs(void)
+{
+	DISGINT;
+	snap_data = tube_revs;
+	ENGINT;
+}
+
+
+#IF FLOW_SENSOR
+static void Snap_Flow_Window(void)
+{
+	DISGINT;
+	snap_data = flow_window;
+	ENGINT;
+}
+
+
+#IF FLOW_SENSOR_SIM
+// Turns the steps in snap_data into the pulses the simulated pump would give:
+// steps * uL/rev / steps/rev, scaled by flow_sim_nl_per_ul and divided by the
+// K-factor. Both remainders carry into the next window.
+static void Sim_Flow_Pulses(void)
+{
+	math_mult_a = snap_data;
+	math_mult_b = stepper_units_per_rev;
+	word_multiply();
+	long_num = math_product + flow_sim_ul_rem;
+	math_divisor = stepper_steps_per_rev;
+	Long_Divide();
+	flow_sim_ul_rem = math_remainder;
+
+	math_mult_a = long_num;
+	math_mult_b = flow_sim_nl_per_ul;
+	word_multiply();
+	long_num = math_product + flow_sim_nl_rem;
+	math_divisor = flow_nl_per_pulse;
+	Long_Divide();
+	flow_sim_nl_rem = math_remainder;
+	snap_data = long_num;
+}
+#ENDIF
+#ENDIF
 
 
 // EEPROM OPERATIONS
+
+// Writes the field staged in eeprom_buff only if the stored bytes differ
+static void Store_Field(void)
+{
+	temp_data2$0 = eeprom_buff[2];
+	temp_data2$1 = eeprom_buff[3];
+	temp_data2$2 = eeprom_buff[4];
+	EEPROM_Read();
+
+	if ((eeprom_buff[2] == temp_data2$0) && (eeprom_buff[3] == temp_data2$1)
+		&& (eeprom_buff[4] == temp_data2$2)) return;
+
+	eeprom_buff[2] = temp_data2$0;
+	eeprom_buff[3] = temp_data2$1;
+	eeprom_buff[4] = temp_data2$2;
+	EEPROM_Write();
+#IF EE_VERIFY
+	ee_verify = 1;
+#ENDIF
+}
+
+
+static void Save_Tube_Revs(void)
+{
+	Snap_Tube_Revs();
+	eeprom_buff[1] = ADDR_TUBE_REVS;
+	eeprom_buff[2] = snap_data$0;
+	eeprom_buff[3] = snap_data$1;
+	eeprom_buff[4] = snap_data$2;
+	Store_Field();
+}
+
+
 static void Save_Settings(void)
 {
 	// Not enough ROM to switch case the saves
 	eeprom_buff[1] = ADDR_SAVED;
 	eeprom_buff[2] = EEPROM_INIT_VAL;
-	EEPROM_Write();
+	eeprom_buff[3] = 0;
+	eeprom_buff[4] = 0;
+	Store_Field();
 
 	eeprom_buff[1] = ADDR_DIR;
 	if (stepper_dir) eeprom_buff[2] = 1;
 	else eeprom_buff[2] = 0;
-	EEPROM_Write();
+#IF HAS_OSC
+	// The interrupt flips stepper_dir while oscillating
+	if (osc_active)
+	{
+		if (osc_home_dir) eeprom_buff[2] = 1;
+		else eeprom_buff[2] = 0;
+	}
+#ENDIF
+	eeprom_buff[3] = 0;
+	eeprom_buff[4] = 0;
+	Store_Field();
+
+#IF HAS_TUBES
+	eeprom_buff[1] = ADDR_TUBE;
+	eeprom_buff[2] = tube_index;
+	eeprom_buff[3] = 0;
+	eeprom_buff[4] = 0;
+	Store_Field();
+#ENDIF
 
 	eeprom_buff[1] = ADDR_UNITS_REV;
-	eeprom_buff[2] = stepper_units_per_rev$0;
-	eeprom_buff[3] = stepper_units_per_rev$1;
-	EEPROM_Write();
+	eeprom_buff[2] = tube_units_per_rev$0;
+	eeprom_buff[3] = tube_units_per_rev$1;
+	eeprom_buff[4] = tube_units_frac;
+	Store_Field();
+
+	Save_Tube_Revs();
+
+#IF HAS_RATE_UNITS
+	eeprom_buff[1] = ADDR_RATE_UNITS;
+	eeprom_buff[2] = rate_units;
+	eeprom_buff[3] = 0;
+	eeprom_buff[4] = 0;
+	Store_Field();
+#ENDIF
 
 	eeprom_buff[1] = ADDR_VELOCITY;
 	eeprom_buff[2] = stepper_units_per_min$0;
 	eeprom_buff[3] = stepper_units_per_min$1;
-	EEPROM_Write();
+	eeprom_buff[4] = 0;
+	Store_Field();
 
+#IF HAS_VOLUME
 	eeprom_buff[1] = ADDR_VOLUME;
 	eeprom_buff[2] = stepper_units_per_run$0;
 	eeprom_buff[3] = stepper_units_per_run$1;
 	eeprom_buff[4] = stepper_units_per_run$2;
-	EEPROM_Write();
+	Store_Field();
+#ENDIF
 }
 
 static void Read_Settings(void)
 {
-	if (init_flag) eeprom_buff[1] = ADDR_SAVED; 
+	if (init_flag)
+	{
+		eeprom_buff[1] = ADDR_SAVED;
+		EEPROM_Read();
+	}
 	else
 	{
+		eeprom_buff[1] = ADDR_DIR;
 		EEPROM_Read();
 		if (eeprom_buff[2])  stepper_dir = 1;
 		else stepper_dir = 0;
 
+#IF HAS_TUBES
+		eeprom_buff[1] = ADDR_TUBE;
+		EEPROM_Read();
+		tube_index = eeprom_buff[2];
+		if (tube_index >= TUBE_COUNT) tube_index = 0;
+#ENDIF
+
+#IF HAS_RATE_UNITS
+		eeprom_buff[1] = ADDR_RATE_UNITS;
+		EEPROM_Read();
+		rate_units = eeprom_buff[2];
+		if (rate_units >= RATE_UNIT_COUNT) rate_units = RATE_UL_MIN;
+#ENDIF
+
 		eeprom_buff[1] = ADDR_UNITS_REV;
 		EEPROM_Read();
-		stepper_units_per_rev$0 = eeprom_buff[2];
-		stepper_units_per_rev$1 = eeprom_buff[3];
+		tube_units_per_rev$0 = eeprom_buff[2];
+		tube_units_per_rev$1 = eeprom_buff[3];
+		tube_units_frac = eeprom_buff[4];
+
+		eeprom_buff[1] = ADDR_TUBE_REVS;
+		EEPROM_Read();
+		tube_revs$0 = eeprom_buff[2];
+		tube_revs$1 = eeprom_buff[3];
+		tube_revs$2 = eeprom_buff[4];
 
 		eeprom_buff[1] = ADDR_VELOCITY;
 		EEPROM_Read();
 		stepper_units_per_min$0 = eeprom_buff[2];
 		stepper_units_per_min$1 = eeprom_buff[3];
 
+#IF HAS_VOLUME
 		eeprom_buff[1] = ADDR_VOLUME;
 		EEPROM_Read();
 		stepper_units_per_run$0 = eeprom_buff[2];
 		stepper_units_per_run$1 = eeprom_buff[3];
 		stepper_units_per_run$2 = eeprom_buff[4];
+#ENDIF
 	}
 }
 
 
-// STEPPER OPERATIONS
-static void Check_And_Store_Value(void)
+#IF EE_VERIFY
+// Re-runs Save_Settings while stopped until a pass writes nothing; after
+// eeprom_retries passes that still wrote, ee_error is shown
+static void Service_EEPROM(void)
 {
-	switch (curr_screen)
+	if (!ee_verify || stepper_is_moving) return;
+	ee_verify = 0;
+	Save_Settings();
+
+	if (!ee_verify)
 	{
+		ee_retry_cnt = 0;
+		if (ee_error)
+		{
+			ee_error = 0;
+			render_pending = 1;
+		}
+		return;
+	}
 
-		case UNITS_PAGE :
-			if (input_data > 0xFFFF) input_data = 0xFFFF;
-			stepper_units_per_rev = input_data;
-			break;
+	ee_retry_cnt++;
+	if (ee_retry_cnt < eeprom_retries) return;
+	ee_retry_cnt = 0;
+	ee_verify = 0;
+	ee_error = 1;
+	render_pending = 1;
+}
+#ENDIF
 
-		case VOL_PAGE :
-			if (input_data > 0xFFFFFF) input_data = 0xFFFFFF;
-			stepper_units_per_run = input_data;
-			break;
 
-		case FLOW_PAGE :
-			if (input_data > 0xFFFF) input_data = 0xFFFF;
-			stepper_units_per_min = input_data;
+// STEPPER OPERATIONS
 
-			if (dir_sign) stepper_dir = 1;
-			else stepper_dir = 0;
-			break;
+// Steps for one volume run, V * S / U rounded half up and saturated, cached for
+// the next start. U is run_units with the volume scaled by 2^run_shift.
+// tools/run_steps_ref.py checks it; rerun it after any change here.
+static void Compute_Run_Steps(void)
+{
+	run_steps = 0;
+	if (!run_units) return;
+
+	long_num = stepper_units_per_run;
+	temp_data2$0 = run_shift;
+	while (temp_data2$0--) long_num <<= 1;
+	math_divisor  = run_units;
+	Long_Divide();
+	temp_data2 = long_num;
+
+	// Fraction of a revolution
+	math_mult_a = math_remainder;
+	math_mult_b = stepper_steps_per_rev;
+	word_multiply();
+	long_num = math_product + (run_units >> 1);
+	math_divisor  = run_units;
+	Long_Divide();
+	run_steps = long_num;
+
+	// Whole revolutions, low 16 bits
+	math_mult_a = temp_data2;
+	math_mult_b = stepper_steps_per_rev;
+	word_multiply();
+	run_steps += math_product;
+
+	// Whole revolutions, high 16 bits
+	math_mult_a$0 = temp_data2$2;
+	math_mult_a$1 = temp_data2$3;
+	math_mult_b = stepper_steps_per_rev;
+	word_multiply();
+	if (math_product$2 || math_product$3)
+	{
+		run_steps = 0xFFFFFFFF;
+		return;
 	}
-	Save_Settings();
+	temp_data2   = 0;
+	temp_data2$2 = math_product$0;
+	temp_data2$3 = math_product$1;
+	run_steps += temp_data2;
+	if (run_steps < temp_data2) run_steps = 0xFFFFFFFF;
 }
 
 
-// BUTTON OPERATIONS
-static void Process_Inputs(void)
+// Derates the calibrated uL/rev (with its 1/256 uL trim) by tubing wear into
+// run_units/run_shift for the step count and whole uL for the velocity math
+static void Apply_Wear(void)
 {
-	temp_data$0  = active_inputs & _FIELD(start_button);
-	temp_data$1  = active_inputs & _FIELD(select_button);
-	temp_data2$0 = active_inputs & _FIELD(rotary_input1);
-	temp_data2$1 = active_inputs & _FIELD(rotary_input2);
+	Snap_Tube_Revs();
+	math_mult_a = snap_data >> 10;
+	math_mult_b = wear_per_krev;
+	word_multiply();
+	if (math_product > wear_max_loss) math_product = wear_max_loss;
 
+	math_mult_a = tube_units_per_rev;
+	math_mult_b = math_product;
+	word_multiply();
+
+	// Derated uL/rev in 1/256 uL
+	long_num = 0;
+	long_num$0 = tube_units_frac;
+	long_num$1 = tube_units_per_rev$0;
+	long_num$2 = tube_units_per_rev$1;
+	long_num -= math_product >> 8;
+
+	stepper_units_per_rev$0 = long_num$1;
+	stepper_units_per_rev$1 = long_num$2;
+	if (!stepper_units_per_rev) stepper_units_per_rev = 1;
+
+	// Keep as many fraction bits as fit in 16 bits
+	run_shift = 8;
+	while (long_num > 0xFFFF)
+	{
+		long_num >>= 1;
+		run_shift--;
+	}
+	run_units = long_num;
+
+	Compute_Run_Steps();
+#IF SERIAL_RX
+	math_mult_b = serial_max_steps;
+	Steps_To_Rate();
+	rx_max_rate = long_num;
+#ENDIF
+}
+
+
+static void Reset_Tube_Wear(void)
+{
+	DISGINT;
+	tube_revs = 0;
+	rev_steps = 0;
+	ENGINT;
+}
+
+
+#IF HAS_TUBES
+// Steps the browsed tubing entry with the encoder; nothing is applied or
+// stored until select commits it in Check_And_Store_Value
+static void Browse_Tube(void)
+{
+	if (shift_r_flag)
+	{
+		tube_browse++;
+		if (tube_browse >= TUBE_COUNT) tube_browse = 0;
+	}
+	else
+	{
+		if (!tube_browse) tube_browse = TUBE_COUNT;
+		tube_browse--;
+	}
+	update_display = 1;
+}
+#ENDIF
+
+
+#IF STALL_DETECT
+// Volume the stalled run still owed, saturated at 24 bits
+static void Compute_Stall_Volume(void)
+{
+	long_num = stall_steps;
+	math_divisor  = stepper_steps_per_rev;
+	Long_Divide();
+	temp_data2 = long_num;
+
+	math_mult_a = math_remainder;
+	math_mult_b = stepper_units_per_rev;
+	word_multiply();
+	long_num = math_product + (stepper_steps_per_rev >> 1);
+	math_divisor  = stepper_steps_per_rev;
+	Long_Divide();
+	stall_volume = long_num;
+
+	if (temp_data2 > 0xFFFF)
+	{
+		stall_volume = 0xFFFFFF;
+		return;
+	}
+	math_mult_a = temp_data2;
+	math_mult_b = stepper_units_per_rev;
+	word_multiply();
+	stall_volume += math_product;
+	if (stall_volume > 0xFFFFFF) stall_volume = 0xFFFFFF;
+}
+#ENDIF
+
+
+#IF HAS_VOLUME
+// Extends a moving volume run by topup_steps; prime and calibration runs excluded
+static void Top_Up_Run(void)
+{
+	if (!stepper_dist_mode) return;
+#IF GRAV_CAL
+	if (cal_active) return;
+#ENDIF
+
+	DISGINT;
+	if (stepper_is_moving)
+	{
+		steps_left += topup_steps;
+		if (steps_left < topup_steps) steps_left = 0xFFFFFFFF;
+	}
+	ENGINT;
+}
+#ENDIF
+
+
+static void Check_And_Store_Value(void)
+{
+	Load_Field_Range();
+	if (input_data > edit_max) input_data = edit_max;
+	elseif (input_data < edit_min) input_data = edit_min;
+
+	switch (curr_screen)
+	{
+
+		// Unchanged fields return without recomputing or saving
+#IF HAS_TUBES
+		case TUBE_PAGE :
+			if (tube_browse == tube_index) return;
+			tube_index = tube_browse;
+			A = tube_index;
+			Tube_Units_Lo();
+			tube_units_per_rev$0 = A;
+			A = tube_index;
+			Tube_Units_Hi();
+			tube_units_per_rev$1 = A;
+			tube_units_frac = 0;
+			Reset_Tube_Wear();
+			break;
+#ENDIF
+
+		case UNITS_PAGE :
+			if (tube_units_per_rev == input_data) return;
+			tube_units_per_rev = input_data;
+			tube_units_frac = 0;
+			Reset_Tube_Wear();
+			break;
+
+#IF HAS_VOLUME
+		// A larger volume stored during a volume run also tops that run up
+		case VOL_PAGE :
+			if (stepper_units_per_run == input_data) return;
+			stepper_units_per_run = input_data;
+			topup_steps = run_steps;
+			Apply_Wear();
+#IF HAS_OSC
+			if (osc_active)
+			{
+				DISGINT;
+				osc_half = run_steps;
+				ENGINT;
+			}
+#ENDIF
+			if (run_steps > topup_steps)
+			{
+				topup_steps = run_steps - topup_steps;
+				Top_Up_Run();
+			}
+			Save_Settings();
+			return;
+#ENDIF
+
+		case FLOW_PAGE :
+			if (stepper_units_per_min == input_data)
+			{
+				if (dir_sign && stepper_dir) return;
+				if (!dir_sign && !stepper_dir) return;
+			}
+			stepper_units_per_min = input_data;
+			if (stepper_is_moving)
+			{
+				vel_target = stepper_units_per_min;
+				vel_pending = 1;
+#IF FLOW_SENSOR
+				flow_integral = 0x8000;
+#ENDIF
+			}
+
+#IF HAS_OSC
+			// The new direction applies from the next oscillation run
+			if (osc_active)
+			{
+				if (dir_sign) osc_home_dir = 1;
+				else osc_home_dir = 0;
+				break;
+			}
+#ENDIF
+			if (dir_sign) stepper_dir = 1;
+			else stepper_dir = 0;
+			break;
+	}
+	Apply_Wear();
+	Save_Settings();
+}
+
+
+#IF TRACE
+// TRACE OPERATIONS
+
+// Appends trace_clock (high byte first) and trace_event to the ring,
+// overwriting the oldest. Events: 1n inputs, 2n gestures, 3n state, 4n screen,
+// 50 start, 51 finish, 52 stall. tools/trace_decode.py reads the dump.
+static void Trace_Event(void)
+{
+	DISGINT;
+	*trace_ptr = trace_clock$1;
+	trace_ptr++;
+	*trace_ptr = trace_clock$0;
+	ENGINT;
+	trace_ptr++;
+	*trace_ptr = trace_event;
+	trace_ptr++;
+	trace_head += 3;
+	if (trace_head == TRACE_BYTES)
+	{
+		trace_head = 0;
+		trace_ptr = trace_buf;
+	}
+}
+#ENDIF
+
+
+// BUTTON OPERATIONS
+static void Process_Inputs(void)
+{
+	// Snapshot and clear together so an edge latched in between is not lost
+	DISGINT;
+	temp_data2$2 = active_inputs;
 	active_inputs = 0 ;
+	gesture_flags = (gesture_flags & 0xF0) | gesture_inputs;
+	gesture_inputs = 0;
+	ENGINT;
+
+	temp_data$0  = temp_data2$2 & _FIELD(start_button);
+	temp_data$1  = temp_data2$2 & _FIELD(select_button);
+	temp_data2$0 = temp_data2$2 & _FIELD(rotary_input1);
+	temp_data2$1 = temp_data2$2 & _FIELD(rotary_input2);
 
 	if (temp_data$0)  start_flag  = 1;
 	if (temp_data$1)  select_flag = 1;
@@ -580,12 +1749,45 @@ static void Process_Inputs(void)
 	{
 		shift_r_flag = 0;
 		shift_flag  = 1;
-		if (rotary_input2)  shift_r_flag = 1;
+		if (temp_data2$1)  shift_r_flag = 1;
+	}
+
+#IF TRACE
+	trace_event = 0x10;
+	if (start_flag)   trace_event |= 0x01;
+	if (select_flag)  trace_event |= 0x02;
+	if (shift_flag)   trace_event |= 0x04;
+	if (shift_r_flag) trace_event |= 0x08;
+	if (trace_event != 0x10) Trace_Event();
+
+	trace_event = gesture_flags & 0x0F;
+	if (trace_event)
+	{
+		trace_event |= 0x20;
+		Trace_Event();
 	}
+#ENDIF
 }
 
 
 // STATE OPERATIONS
+
+// Restores the edited sign from the stored direction
+static void Restore_Dir_Sign(void)
+{
+	if (stepper_dir) dir_sign = 1;
+	else dir_sign = 0;
+#IF HAS_OSC
+	if (osc_active)
+	{
+		if (osc_home_dir) dir_sign = 1;
+		else dir_sign = 0;
+	}
+#ENDIF
+}
+
+
+#IF HAS_UI
 static void Change_Next_Screen(void)
 {
 	if (shift_r_flag)
@@ -598,24 +1800,819 @@ static void Change_Next_Screen(void)
 		next_screen--;
 		if (next_screen == 0) next_screen = EXIT_PAGE;
 	}
+#IF !HAS_TUBES
+	// The tubing page is never first or last, so stepping over it cannot wrap
+	if (next_screen == TUBE_PAGE)
+	{
+		if (shift_r_flag) next_screen++;
+		else next_screen--;
+	}
+#ENDIF
+	update_display = 1;
+}
+
+
+#IF HAS_RATE_UNITS
+// Cycles the home page flow rate units; the choice is stored once it settles
+static void Next_Rate_Units(void)
+{
+	rate_units++;
+	if (rate_units >= RATE_UNIT_COUNT) rate_units = RATE_UL_MIN;
+	units_unsaved = 1;
+	update_display = 1;
+}
+
+
+static void Save_Rate_Units(void)
+{
+	units_unsaved = 0;
+	Save_Settings();
+}
+#ENDIF
+
+
+#IF GESTURES
+static void Edit_Home_Value(void)
+{
+#IF HAS_VOLUME
+	if (stepper_dist_mode) next_screen = VOL_PAGE;
+	else next_screen = FLOW_PAGE;
+#ELSE
+	next_screen = FLOW_PAGE;
+#ENDIF
+	Load_Field_Range();
+	next_state = EDIT_MODE;
+	col_index = RETURN_COL;
+	lcd_command = 1;
+	lcd_trx_byte = LCD_CURSOR_ON;
+	LCD_Write_Byte();
+	update_display = 1;
+}
+
+
+static void Return_Home(void)
+{
+	Restore_Dir_Sign();
+	next_screen = HOME_PAGE;
+	next_state = MENU_MODE;
+	lcd_command = 1;
+	lcd_trx_byte = LCD_CURSOR_OFF;
+	LCD_Write_Byte();
+	update_display = 1;
+}
+
+
+// Leaves an edit without storing it; the page redraw reloads the stored value
+static void Cancel_Edit(void)
+{
+	Restore_Dir_Sign();
+	next_state = MENU_MODE;
+	lcd_command = 1;
+	lcd_trx_byte = LCD_CURSOR_OFF;
+	LCD_Write_Byte();
+	update_display = 1;
+}
+
+
+// Defers select where its first press would act before a gesture is known
+static void Update_Select_Defer(void)
+{
+	// The commit must not run ahead of a hold-to-cancel
+	if ((curr_state == EDIT_MODE) && (col_index == RETURN_COL)) select_defer = 1;
+#IF HAS_FLOW && HAS_VOLUME
+	elseif ((curr_state == MENU_MODE) && (curr_screen == MODE_PAGE)) select_defer = 1;
+#ENDIF
+	else select_defer = 0;
+}
+#ENDIF
+#ENDIF
+
+
+// STEPPER CONTROL
+#IF TMC_UART
+// Picks the run current for the starting rate. Only called while stopped: a
+// UART frame masks interrupts for ~1 ms and would drop step interrupts.
+static void Update_Driver_Current(void)
+{
+	if (vel_applied > tmc_boost_rate) A = tmc_irun_high;
+	else A = tmc_irun_low;
+	if (A == tmc_irun) return;
+
+	tmc_irun = A;
+	TMC_Write_Current();
+}
+#ENDIF
+
+
+static void Run_Motor(void)
+{
+#IF TRACE
+	trace_event = 0x50;
+	Trace_Event();
+#ENDIF
+	vel_applied = stepper_units_per_min;
+	vel_target  = stepper_units_per_min;
+#IF TMC_UART
+	Update_Driver_Current();
+#ENDIF
+	// Run state is reset before the first step interrupt can use it
+	vel_pending = 0;
+	vel_staged = 0;
+#IF FLOW_SENSOR
+	flow_integral = 0x8000;
+	flow_ready = 0;
+#IF FLOW_SENSOR_SIM
+	flow_sim_ul_rem = 0;
+	flow_sim_nl_rem = 0;
+#ENDIF
+#ENDIF
+#IF STALL_DETECT
+	stall_flags = 0;
+#IF STALL_SIM
+	stall_sim_cnt = 0;
+#ENDIF
+#ENDIF
+	Stepper_Set_Dir();
+	Stepper_Set_Vel();
+	Stepper_Enable();
+	Stepper_Start();
+	update_display = 1;
+}
+
+
+static void Start_Pump(void)
+{
+	if (stepper_dist_mode)
+	{
+		if (!run_steps) return;
+		steps_left = run_steps;
+	}
+#IF HAS_OSC
+	// Oscillation counts half cycles in steps_left, reloaded from osc_half
+	if (osc_mode && !priming)
+	{
+		if (!run_steps) return;
+		steps_left = run_steps;
+		osc_half = run_steps;
+		osc_home_dir = stepper_dir;
+		osc_active = 1;
+	}
+#ENDIF
+	Run_Motor();
+}
+
+
+#IF HAS_OSC
+// Stops half-cycle counting and puts back the set direction
+static void End_Oscillation(void)
+{
+	if (!osc_active) return;
+	osc_active = 0;
+	stepper_dir = osc_home_dir;
+}
+#ENDIF
+
+
+static void Finish_Run(void)
+{
+#IF TRACE
+	trace_event = 0x51;
+	Trace_Event();
+#ENDIF
+	Stepper_Disable();
+#IF HAS_OSC
+	End_Oscillation();
+#ENDIF
+	Save_Tube_Revs();
+	Apply_Wear();
+	update_display = 1;
+}
+
+
+#IF STALL_DETECT
+// Shows the stall on the home page as soon as the interrupt reports it
+static void Service_Stall(void)
+{
+	if (!stall_pending) return;
+	stall_pending = 0;
+	stalled = 1;
+#IF TRACE
+	trace_event = 0x52;
+	Trace_Event();
+#ENDIF
+
+	Compute_Stall_Volume();
+	Finish_Run();
+	if (curr_screen == HOME_PAGE) render_pending = 1;
+}
+#ENDIF
+
+
+// Computes a running rate change in the idle loop, walking vel_ramp_step per
+// step, and stages the timer values for Pump_Step_Interrupt to load
+static void Service_Velocity(void)
+{
+	if (!vel_pending || vel_staged) return;
+
+	if (!stepper_is_moving)
+	{
+		vel_pending = 0;
+		return;
+	}
+
+	// Differences, not sums, so rates near 0xFFFF cannot wrap
+	if (vel_ramp_step && (vel_target > vel_applied) && (vel_target - vel_applied > vel_ramp_step)) vel_applied += vel_ramp_step;
+	elseif (vel_ramp_step && (vel_applied > vel_target) && (vel_applied - vel_target > vel_ramp_step)) vel_applied -= vel_ramp_step;
+	else
+	{
+		vel_applied = vel_target;
+		vel_pending = 0;
+	}
+
+	// Stepper_Set_Vel reads the setting and writes the timer, so it runs on
+	// the intermediate rate and the running period is put back at once
+	temp_data2$0 = step_tmr_scale;
+	temp_data2$1 = step_tmr_bound;
+	temp_data = stepper_units_per_min;
+	stepper_units_per_min = vel_applied;
+	Stepper_Set_Vel();
+	stepper_units_per_min = temp_data;
+
+	DISGINT;
+	vel_scale = step_tmr_scale;
+	vel_bound = step_tmr_bound;
+	step_tmr_scale = temp_data2$0;
+	step_tmr_bound = temp_data2$1;
+	vel_staged = 1;
+	ENGINT;
+}
+
+
+#IF FLOW_SENSOR
+// PI trim of the applied rate from the flow window; uL/min is exactly
+// (pulses * nL/pulse * 15) >> 8 for the 1.024 s window
+static void Service_Flow(void)
+{
+	if (!flow_ready) return;
+	flow_ready = 0;
+	if (!stepper_is_moving || priming) return;
+
+	Snap_Flow_Window();
+#IF FLOW_SENSOR_SIM
+	Sim_Flow_Pulses();
+#ENDIF
+	math_mult_a = snap_data;
+	math_mult_b = flow_nl_per_pulse * 15;
+	word_multiply();
+	temp_data2 = math_product >> 8;
+	if (temp_data2 > 0xFFFF) temp_data2 = 0xFFFF;
+	temp_data = temp_data2;
+
+	// Rate is offset by 0x10000 so the correction can go either way
+	temp_data2 = stepper_units_per_min + 0x10000;
+	if (temp_data < stepper_units_per_min)
+	{
+		// Under-delivering: raise the rate
+		temp_data = stepper_units_per_min - temp_data;
+		if (flow_integral > 0xFFFF - temp_data) flow_integral = 0xFFFF;
+		else flow_integral += temp_data;
+		temp_data2 += temp_data >> flow_kp_shift;
+	}
+	else
+	{
+		// Over-delivering: lower the rate
+		temp_data = temp_data - stepper_units_per_min;
+		if (flow_integral < temp_data) flow_integral = 0;
+		else flow_integral -= temp_data;
+		temp_data2 -= temp_data >> flow_kp_shift;
+	}
+
+	temp_data2 += flow_integral >> flow_ki_shift;
+	temp_data2 -= 0x8000 >> flow_ki_shift;
+	if (temp_data2 <= 0x10000) vel_target = 1;
+	elseif (temp_data2 > 0x1FFFF) vel_target = 0xFFFF;
+	else vel_target = temp_data2 - 0x10000;
+
+	// The trim must not push the stepper past max_steps_per_sec either
+	math_mult_b = max_steps_per_sec;
+	Steps_To_Rate();
+	if (vel_target > long_num) vel_target = long_num;
+	if (!vel_target) vel_target = 1;
+
+	vel_pending = 1;
+}
+#ENDIF
+
+
+#IF GRAV_CAL || SERIAL_RX
+// SERIAL OPERATIONS
+// Sends the byte in uart_trx_byte followed by CR LF
+static void Send_Line(void)
+{
+	UART_Write_Byte();
+	uart_trx_byte = 0x0D;
+	UART_Write_Byte();
+	uart_trx_byte = 0x0A;
+	UART_Write_Byte();
+}
+#ENDIF
+
+
+#IF GRAV_CAL
+// BALANCE OPERATIONS
+
+
+// Parses a stable "S S <mass> g" reply into cal_mass (mg); anything else sets
+// cal_error
+static void Read_Balance_Mass(void)
+{
+	cal_mass = 0;
+	cal_index = 0;
+	cal_decimals = 0;
+	cal_point = 0;
+	cal_tries = cal_reply_tries;
+
+	while (1)
+	{
+		UART_Read_Byte();
+		if (uart_timeout)
+		{
+			// T and S are only answered once the balance is stable
+			cal_tries--;
+			if (!cal_tries)
+			{
+				cal_error = 1;
+				return;
+			}
+		}
+		elseif (uart_trx_byte == 0x0A) break;
+		else
+		{
+			if (cal_index == 2)
+			{
+				if (uart_trx_byte != 'S') cal_error = 1;
+			}
+			elseif (cal_index > 2)
+			{
+				if (uart_trx_byte == '-') cal_error = 1;
+				elseif (uart_trx_byte == '.') cal_point = 1;
+				elseif ((uart_trx_byte >= '0') && (uart_trx_byte <= '9'))
+				{
+					cal_mass = (cal_mass << 3) + (cal_mass << 1) + (uart_trx_byte - '0');
+					if (cal_point) cal_decimals++;
+				}
+			}
+			cal_index++;
+		}
+	}
+
+	while (cal_decimals < 3)
+	{
+		cal_mass = (cal_mass << 3) + (cal_mass << 1);
+		cal_decimals++;
+	}
+	while (cal_decimals > 3)
+	{
+		long_num = cal_mass;
+		math_divisor  = 10;
+		Long_Divide();
+		cal_mass = long_num;
+		cal_decimals--;
+	}
+	if (cal_mass > 0xFFFFFF) cal_error = 1;
+}
+
+
+// Tares the balance and dispenses cal_revs revolutions in distance mode
+static void Start_Calibration(void)
+{
+	cal_error = 0;
+	uart_trx_byte = 'T';
+	Send_Line();
+	Read_Balance_Mass();
+	if (cal_error)
+	{
+		update_display = 1;
+		return;
+	}
+
+	math_mult_a = cal_revs;
+	math_mult_b = stepper_steps_per_rev;
+	word_multiply();
+	steps_left = math_product;
+
+	cal_dist_mode = stepper_dist_mode;
+	stepper_dist_mode = 1;
+	cal_active = 1;
+	Run_Motor();
+}
+
+
+static void End_Calibration(void)
+{
+	if (!cal_active) return;
+	stepper_dist_mode = cal_dist_mode;
+	cal_active = 0;
+	cal_settling = 0;
+}
+
+
+// Once the balance settles, uL/rev = mass / cal_revs to 1/256 uL; errors keep
+// the old value
+static void Service_Calibration(void)
+{
+	if (!cal_active || stepper_is_moving) return;
+
+	// The motor holds while the reading settles
+	if (!cal_settling)
+	{
+		cal_settle = cal_settle_ticks;
+		cal_settling = 1;
+		return;
+	}
+	if (cal_settle) return;
+
+	End_Calibration();
+	Stepper_Disable();
+
+	uart_trx_byte = 'S';
+	Send_Line();
+	Read_Balance_Mass();
+
+	if (!cal_error)
+	{
+		long_num = (cal_mass << 8) + (cal_revs >> 1);
+		math_divisor  = cal_revs;
+		Long_Divide();
+		if (long_num > 0xFFFFFF) long_num = 0xFFFF00;
+		if (long_num < 0x100) cal_error = 1;
+		else
+		{
+			tube_units_frac = long_num$0;
+			tube_units_per_rev$0 = long_num$1;
+			tube_units_per_rev$1 = long_num$2;
+		}
+	}
+
+	if (!cal_error)
+	{
+		Reset_Tube_Wear();
+		Apply_Wear();
+		Save_Settings();
+	}
+	render_pending = 1;
+}
+#ENDIF
+
+
+#IF TRACE
+// Sends trace_event as two hex digits
+static void Send_Hex(void)
+{
+	uart_trx_byte = trace_event >> 4;
+	if (uart_trx_byte < 10) uart_trx_byte += '0';
+	else uart_trx_byte += 'A' - 10;
+	UART_Write_Byte();
+
+	uart_trx_byte = trace_event & 0x0F;
+	if (uart_trx_byte < 10) uart_trx_byte += '0';
+	else uart_trx_byte += 'A' - 10;
+	UART_Write_Byte();
+}
+
+
+// Sends the current trace_clock, then the ring oldest entry first, one
+// "TTTT EE" line per entry (unused entries read 0000 00). The walk goes once
+// around the ring, leaving trace_ptr where it started.
+static void Dump_Trace(void)
+{
+	DISGINT;
+	temp_data2$1 = trace_clock$0;
+	trace_event  = trace_clock$1;
+	ENGINT;
+	Send_Hex();
+	trace_event = temp_data2$1;
+	Send_Hex();
+	uart_trx_byte = 0x0D;
+	UART_Write_Byte();
+	uart_trx_byte = 0x0A;
+	UART_Write_Byte();
+
+	temp_data2$0 = trace_entries;
+	while (temp_data2$0--)
+	{
+		trace_event = *trace_ptr;
+		Send_Hex();
+		trace_ptr++;
+		trace_event = *trace_ptr;
+		Send_Hex();
+		trace_ptr++;
+		uart_trx_byte = ' ';
+		UART_Write_Byte();
+		trace_event = *trace_ptr;
+		Send_Hex();
+		trace_ptr++;
+		uart_trx_byte = 0x0D;
+		UART_Write_Byte();
+		uart_trx_byte = 0x0A;
+		UART_Write_Byte();
+
+		trace_head += 3;
+		if (trace_head == TRACE_BYTES)
+		{
+			trace_head = 0;
+			trace_ptr = trace_buf;
+		}
+	}
+}
+
+
+#IF !SERIAL_CMD
+// UI builds take only a line holding T, which dumps the ring and replies K.
+// Other lines are ignored, and nothing is sent during a volume run.
+static void Trace_Command(void)
+{
+	temp_data$0 = 0;
+	while (1)
+	{
+		UART_Read_Byte();
+		if (uart_timeout) return;
+		if (uart_trx_byte == 0x0A) break;
+		if (uart_trx_byte == 'T') temp_data$0 = 1;
+	}
+	if (!temp_data$0 || (stepper_is_moving && stepper_dist_mode)) return;
+
+	Dump_Trace();
+	uart_trx_byte = 'K';
+	Send_Line();
+}
+#ENDIF
+#ENDIF
+
+
+#IF SERIAL_CMD
+// One "<letter>[digits]" LF line: F rate, V volume, U uL/rev, D direction,
+// M mode (0 flow, 1 volume, 2 osc), G start, X stop, A top-up, S verify
+// status, T trace. Replies K or E. During a volume run only A and X are
+// taken, unanswered, and lines are only read up to serial_max_steps.
+static void Serial_Command(void)
+{
+	serial_cmd = 0;
+	input_data = 0;
+
+	while (1)
+	{
+		UART_Read_Byte();
+		if (uart_timeout) return;
+		if (uart_trx_byte == 0x0A) break;
+
+		if ((uart_trx_byte >= 'A') && (uart_trx_byte <= 'Z'))
+		{
+			serial_cmd = uart_trx_byte;
+			input_data = 0;
+		}
+		elseif (serial_cmd && (uart_trx_byte >= '0') && (uart_trx_byte <= '9'))
+		{
+			// Stops growing past 24 bits, so a long digit string cannot wrap
+			if (input_data <= 0xFFFFFF) input_data = (input_data << 3) + (input_data << 1) + (uart_trx_byte - '0');
+		}
+	}
+	if (!serial_cmd) return;
+	// A volume run counts steps, so it only takes the unanswered A and X
+	if (stepper_is_moving && stepper_dist_mode && (serial_cmd != 'A') && (serial_cmd != 'X')) return;
+
+	// HOME_PAGE stores nothing, so it marks "no value to store"
+	serial_screen = curr_screen;
+	curr_screen = HOME_PAGE;
+	uart_trx_byte = 'K';
+
+	if (serial_cmd == 'S')
+	{
+		uart_trx_byte = '0';
+		if (ee_error) uart_trx_byte = '1';
+	}
+#IF TRACE
+	elseif (serial_cmd == 'T')
+	{
+		Dump_Trace();
+		uart_trx_byte = 'K';
+	}
+#ENDIF
+	elseif (curr_state != MENU_MODE) uart_trx_byte = 'E';
+	elseif (serial_cmd == 'F') curr_screen = FLOW_PAGE;
+#IF HAS_VOLUME
+	elseif (serial_cmd == 'V') curr_screen = VOL_PAGE;
+#ENDIF
+	elseif (serial_cmd == 'U') curr_screen = UNITS_PAGE;
+	elseif (serial_cmd == 'D')
+	{
+		dir_sign = 0;
+		if (input_data) dir_sign = 1;
+		input_data = stepper_units_per_min;
+		curr_screen = FLOW_PAGE;
+	}
+#IF HAS_VOLUME
+	elseif ((serial_cmd == 'A') && stepper_is_moving && stepper_dist_mode)
+	{
+		// Steps for the added volume, then the cached run count is restored.
+		// Compute_Run_Steps needs a 24-bit volume.
+		if (input_data > 0xFFFFFF) input_data = 0xFFFFFF;
+		temp_data2 = stepper_units_per_run;
+		stepper_units_per_run = input_data;
+		input_data = temp_data2;
+		Compute_Run_Steps();
+		stepper_units_per_run = input_data;
+		topup_steps = run_steps;
+		Top_Up_Run();
+		Compute_Run_Steps();
+	}
+#ENDIF
+#IF HAS_FLOW && HAS_VOLUME
+	elseif ((serial_cmd == 'M') && !stepper_is_moving)
+	{
+		stepper_dist_mode = 0;
+		osc_mode = 0;
+		if (input_data == 1) stepper_dist_mode = 1;
+#IF HAS_OSC
+		elseif (input_data == 2) osc_mode = 1;
+#ENDIF
+		elseif (input_data) uart_trx_byte = 'E';
+	}
+#ENDIF
+	elseif (((serial_cmd == 'G') && !stepper_is_moving) || ((serial_cmd == 'X') && stepper_is_moving))
+	{
+		DISGINT;
+		active_inputs |= _FIELD(start_button);
+		ENGINT;
+	}
+	else uart_trx_byte = 'E';
+
+	next_screen = curr_screen;
+	if (curr_screen != HOME_PAGE) Check_And_Store_Value();
+	curr_screen = serial_screen;
+	next_screen = serial_screen;
+	if (!(stepper_is_moving && stepper_dist_mode)) Send_Line();
+	render_pending = 1;
+}
+#ENDIF
+
+
+#IF HAS_UI
+// POWER OPERATIONS
+
+// Backlight then display off with inactivity; without a serial link the core
+// also sleeps in stopexe until the next input scan tick
+static void Service_Power(void)
+{
+	if (disp_off)
+	{
+#IF !SERIAL_RX
+		// Polling for a serial start bit needs the core awake
+		stopexe;
+#ENDIF
+		return;
+	}
+
+	if (idle_secs >= disp_off_secs)
+	{
+		lcd_command = 1;
+		lcd_trx_byte = LCD_DISP_F;
+		LCD_Write_Byte();
+		Backlight_Off();
+		bl_off = 1;
+		disp_off = 1;
+	}
+	elseif ((idle_secs >= bl_off_secs) && !bl_off)
+	{
+		Backlight_Off();
+		bl_off = 1;
+	}
+}
+
+
+// Restarts the inactivity timer and powers the display back up
+static void Wake_Display(void)
+{
+	idle_secs = 0;
+	if (!bl_off) return;
+
+	// The display on command also sets the backlight bit again
+	lcd_command = 1;
+	if (curr_state == MENU_MODE) lcd_trx_byte = LCD_CURSOR_OFF;
+	else lcd_trx_byte = LCD_CURSOR_ON;
+	LCD_Write_Byte();
+	disp_off = 0;
+	bl_off = 0;
+}
+#ENDIF
+
+
+static void Idle_Tasks(void)
+{
+#IF SERIAL_RX
+	// Received frames mask interrupts, so a fast counted run is not read
+	if (!uart_rx && (!stepper_is_moving || (!stepper_dist_mode && !osc_active) || (vel_applied <= rx_max_rate)))
+	{
+#IF SERIAL_CMD
+		Serial_Command();
+#ELSE
+		Trace_Command();
+#ENDIF
+	}
+#ENDIF
+#IF FLOW_SENSOR
+	Service_Flow();
+#ENDIF
+	Service_Velocity();
+#IF STALL_DETECT
+	Service_Stall();
+#ENDIF
+#IF GRAV_CAL
+	Service_Calibration();
+#ENDIF
+#IF EE_VERIFY
+	Service_EEPROM();
+#ENDIF
+#IF HAS_UI
+	Service_Power();
+#ENDIF
+#IF HAS_RATE_UNITS
+	if (units_unsaved && (idle_secs >= units_save_secs)) Save_Rate_Units();
+#ENDIF
+#IF REDRAW_SCHED
+	if (render_pending && !frame_wait && (curr_state == MENU_MODE)) Redraw();
+#IF HAS_UI
+	if (line_pending && !frame_wait) Flush_Data_Line();
+#ENDIF
+#ELSE
+	if (render_pending && (curr_state == MENU_MODE)) Redraw();
+#ENDIF
+}
+
+
+#IF GESTURES
+// Holding start runs the pump continuously at the set rate until release,
+// regardless of the flow/volume selection.
+static void Prime_Pump(void)
+{
+	if (stepper_is_moving) Stepper_Stop();
+#IF GRAV_CAL
+	End_Calibration();
+#ENDIF
+#IF HAS_OSC
+	End_Oscillation();
+#ENDIF
+	prime_dist_mode = stepper_dist_mode;
+	stepper_dist_mode = 0;
+	priming = 1;
+	Start_Pump();
+}
+
+
+static void End_Prime(void)
+{
+	Stepper_Stop();
+	stepper_dist_mode = prime_dist_mode;
+	priming = 0;
 	update_display = 1;
 }
+#ENDIF
 
 
 // MODE OPERATIONS
+#IF HAS_UI
 static void Operation_Menu(void)
 {
 	if (select_flag) 
 	{
+#IF HAS_FLOW && HAS_VOLUME
 		if(curr_screen == MODE_PAGE && !stepper_is_moving)
 		{
+#IF HAS_OSC
+			// FLOW -> VOLUME -> OSCILLATE -> FLOW
+			if (stepper_dist_mode)
+			{
+				stepper_dist_mode = 0;
+				osc_mode = 1;
+			}
+			elseif (osc_mode) osc_mode = 0;
+			else stepper_dist_mode = 1;
+#ELSE
 			if (stepper_dist_mode) stepper_dist_mode = 0;
 			else stepper_dist_mode = 1;
+#ENDIF
 			update_display = 1;
 		}
 
+		// Tubing is browsed like an edit from RETURN_COL, but never in a run
+		elseif ((curr_screen == TUBE_PAGE) && stepper_is_moving) return;
+#ELSE
+		if ((curr_screen == TUBE_PAGE) && stepper_is_moving) return;
+#ENDIF
+
 		else
 		{
+			Load_Field_Range();
 			next_state = EDIT_MODE;
 			col_index = RETURN_COL;
 			lcd_command = 1;
@@ -651,6 +2648,13 @@ static void Operation_Edit(void)
 	}
 	elseif (shift_flag)
 	{
+#IF HAS_TUBES
+		if (curr_screen == TUBE_PAGE)
+		{
+			Browse_Tube();
+			return;
+		}
+#ENDIF
 		if (shift_r_flag) col_index++;
 		else col_index--;
 
@@ -658,6 +2662,7 @@ static void Operation_Edit(void)
 		elseif (col_index < col_data_s) col_index = col_data_s;
 	}
 }
+#ENDIF
 
 
 //===================//
@@ -666,18 +2671,43 @@ static void Operation_Edit(void)
 
 void Pump_Initialize(void)
 {
+#IF HAS_UI
 	lcd_device_addr = LCD_DRIVER;
 	LCD_Initialize();
+#ENDIF
 	Stepper_Initialize();
-	Button_Initialize();
 	EEPROM_Initialize();
 
+	PBC  &= ~INPUT_PINS;
+	PBPH |= INPUT_PINS;
+	input_stable = PB;
+	input_prev   = input_stable;
+	$ T16M SYSCLK, /4, BIT9;
+	Inten.SCAN_INTR = 1;
+#IF TRACE
+	trace_ptr = trace_buf;
+#ENDIF
+#IF GRAV_CAL || TMC_UART || SERIAL_RX
+	UART_Initialize();
+#ENDIF
+#IF STALL_DETECT
+	PAC.6 = 0;
+#ENDIF
+#IF FLOW_SENSOR && !FLOW_SENSOR_SIM
+	PBC.5  = 0;
+	PBPH.5 = 1;
+	Inten.FLOW_INTR = 1;
+#ENDIF
+
 	
 	stepper_steps_per_rev = def_steps_per_rev;
-	stepper_units_per_rev = def_ul_per_rev;
+	tube_units_per_rev = def_ul_per_rev;
 	stepper_units_per_run = def_volume;
 	stepper_units_per_min = def_ul_per_min;
 	stepper_dir = def_direction;
+#IF !HAS_FLOW
+	stepper_dist_mode = 1;
+#ENDIF
 
 	init_flag = 1;
 	eeprom_buff[0] = 4;
@@ -690,17 +2720,244 @@ void Pump_Initialize(void)
 	}
 	else Save_Settings();
 
-	if (stepper_dir) dir_sign = 1;
-	else dir_sign = 0;
+	Restore_Dir_Sign();
 
-	Render_Screen();
+	Apply_Wear();
+#IF TMC_UART
+	tmc_irun = tmc_irun_low;
+	TMC_Configure();
+#ENDIF
+	Redraw();
+}
+
+
+// Input scan every ~1 ms: two-sample debounce with per-input hold-off, presses
+// latched into active_inputs and holds and double-clicks into gesture_inputs.
+// With select_defer a select press waits out the double-click gap.
+void Pump_Input_Interrupt(void)
+{
+	Intrq.SCAN_INTR = 0;
+	ldt16 scan_count;
+	scan_count += SCAN_T16_SKIP;
+	stt16 scan_count;
+
+	// Changed inputs whose new level was also read on the previous scan
+	input_sample  = PB;
+	input_changed = input_sample ^ input_prev;
+	input_prev    = input_sample;
+	input_changed ^= 0xFF;
+	input_changed &= input_sample ^ input_stable;
+
+	if (holdoff_rot2) holdoff_rot2--;
+	elseif (input_changed & _FIELD(rotary_input2))
+	{
+		input_stable ^= _FIELD(rotary_input2);
+		holdoff_rot2  = enc_holdoff;
+	}
+
+	if (holdoff_rot1) holdoff_rot1--;
+	elseif (input_changed & _FIELD(rotary_input1))
+	{
+		input_stable ^= _FIELD(rotary_input1);
+		holdoff_rot1  = enc_holdoff;
+		if (!(input_sample & _FIELD(rotary_input1)))
+		{
+			active_inputs |= _FIELD(rotary_input1);
+			if (input_stable & _FIELD(rotary_input2)) active_inputs |= _FIELD(rotary_input2);
+		}
+	}
+
+	if (holdoff_start) holdoff_start--;
+	elseif (input_changed & _FIELD(start_button))
+	{
+		input_stable ^= _FIELD(start_button);
+		holdoff_start = btn_holdoff;
+		if (!(input_sample & _FIELD(start_button)))
+		{
+			active_inputs |= _FIELD(start_button);
+#IF GESTURES
+			start_hold = 0;
+#ENDIF
+		}
+#IF GESTURES
+		elseif (start_hold == long_press_ticks) gest_start_up = 1;
+#ENDIF
+	}
+
+	if (holdoff_select) holdoff_select--;
+	elseif (input_changed & _FIELD(select_button))
+	{
+		input_stable ^= _FIELD(select_button);
+		holdoff_select = btn_holdoff;
+		if (!(input_sample & _FIELD(select_button)))
+		{
+#IF GESTURES
+			sel_opened_edit = 0;
+			// Second press inside the gap replaces the select event
+			if (select_gap)
+			{
+				gest_double = 1;
+				select_owed = 0;
+			}
+			elseif (select_defer) select_owed = 1;
+			else active_inputs |= _FIELD(select_button);
+			select_gap  = 0;
+			select_hold = 0;
+#ELSE
+			active_inputs |= _FIELD(select_button);
+#ENDIF
+		}
+#IF GESTURES
+		elseif (select_hold != long_press_ticks) select_gap = double_click_ticks;
+#ENDIF
+	}
+
+	// Gesture timers run on every 16th scan tick
+	gesture_div++;
+	if (gesture_div & 0x0F) return;
+
+#IF TRACE
+	// Trace clock in 4 gesture ticks (~64 ms), wrapping after ~70 minutes
+	if (!(gesture_div & 0x3F)) trace_clock++;
+#ENDIF
+
+#IF GESTURES
+	if (select_gap)
+	{
+		select_gap--;
+		if (!select_gap && select_owed)
+		{
+			select_owed = 0;
+			active_inputs |= _FIELD(select_button);
+		}
+	}
+#ENDIF
+#IF REDRAW_SCHED
+	if (frame_wait) frame_wait--;
+#ENDIF
+#IF GRAV_CAL
+	if (cal_settle) cal_settle--;
+#ENDIF
+
+#IF HAS_UI || FLOW_SENSOR
+	// One divider of 64 gesture ticks (~1.024 s) for the seconds below
+	secs_div++;
+#ENDIF
+#IF HAS_UI
+	if (!(secs_div & 0x3F) && (idle_secs != 0xFF)) idle_secs++;
+#ENDIF
+
+#IF FLOW_SENSOR
+	// Flow measurement window
+	if (!(secs_div & 0x3F))
+	{
+		flow_window = flow_pulses;
+		flow_pulses = 0;
+		flow_ready  = 1;
+	}
+#ENDIF
+
+#IF GESTURES
+	if (!(input_stable & _FIELD(select_button)) && (select_hold != long_press_ticks))
+	{
+		select_hold++;
+		if (select_hold == long_press_ticks)
+		{
+			gest_long_sel = 1;
+			select_owed = 0;
+		}
+	}
+
+	if (!(input_stable & _FIELD(start_button)) && (start_hold != long_press_ticks))
+	{
+		start_hold++;
+		if (start_hold == long_press_ticks) gest_long_start = 1;
+	}
+#ENDIF
+}
+
+
+// Per step: stall check, revolution count, and the steps_left countdown (the
+// upper bytes only every 256 steps). Oscillation reloads osc_half and flips
+// the direction here.
+void Pump_Step_Interrupt(void)
+{
+	Intrq.STEPPER_INTR = 0;
+
+	// A staged rate starts with the period after this step
+	if (vel_staged)
+	{
+		step_tmr_scale = vel_scale;
+		step_tmr_bound = vel_bound;
+		vel_staged = 0;
+	}
+
+#IF STALL_DETECT
+#IF STALL_SIM
+	stall_sim_cnt++;
+	if ((stall_sim_cnt == stall_sim_steps) || stall_diag)
+#ELSE
+	if (stall_diag)
+#ENDIF
+	{
+		Stepper_Stop();
+		stall_steps = steps_left;
+		stall_pending = 1;
+		return;
+	}
+#ENDIF
+
+	rev_steps++;
+	if (rev_steps == stepper_steps_per_rev)
+	{
+		rev_steps = 0;
+		tube_revs++;
+	}
+
+#IF FLOW_SENSOR && FLOW_SENSOR_SIM
+	// Steps; Service_Flow turns the window into sensor pulses
+	flow_pulses++;
+#ENDIF
+
+#IF HAS_OSC
+	if (osc_active)
+	{
+		steps_left--;
+		if (steps_left$0) return;
+		if (steps_left$1 | steps_left$2 | steps_left$3) return;
+		steps_left = osc_half;
+		if (stepper_dir) stepper_dir = 0;
+		else stepper_dir = 1;
+		Stepper_Set_Dir();
+		return;
+	}
+#ENDIF
+
+	if (!stepper_dist_mode) return;
+
+	steps_left--;
+	if (steps_left$0) return;
+	if (steps_left$1 | steps_left$2 | steps_left$3) return;
+	Stepper_Stop();
+}
+
+
+// Called from the Interrupt_Src0 interrupt on each flow sensor edge.
+void Pump_Flow_Interrupt(void)
+{
+	Intrq.FLOW_INTR = 0;
+#IF FLOW_SENSOR
+	flow_pulses++;
+#ENDIF
 }
 
 
 void Pump_State_Machine(void)
 {
-	while(!active_inputs) Button_Poll();
+	while(!active_inputs && !gesture_inputs) Idle_Tasks();
 	Process_Inputs();
+#IF HAS_UI
+	Wake_Display();
 	next_screen = curr_screen;
 	switch (curr_screen)
 	{
@@ -710,6 +2967,9 @@ void Pump_State_Machine(void)
 				next_screen = FLOW_PAGE;
 				update_display = 1;
 			}
+#IF HAS_RATE_UNITS
+			elseif (shift_flag && !stepper_dist_mode) Next_Rate_Units();
+#ENDIF
 			break;
 
 		case EXIT_PAGE :
@@ -721,7 +2981,7 @@ void Pump_State_Machine(void)
 			elseif (shift_flag) Change_Next_Screen();
 			break;
 
-		default : //VOL_PAGE, UNITS_PAGE, STEPS_PAGE, FLOW_PAGE, MODE_PAG
+		default : //VOL_PAGE, TUBE_PAGE, UNITS_PAGE, STEPS_PAGE, FLOW_PAGE, MODE_PAG
 			switch (curr_state)
 			{
 				case MENU_MODE :
@@ -738,29 +2998,73 @@ void Pump_State_Machine(void)
 			}
 	}
 
+#IF GESTURES
+	// Gestures override the page operation. Holding the press that opened an
+	// edit still means "edit the home value"; the scan clears the mark on the
+	// next press.
+	if (select_flag && (curr_state == MENU_MODE) && (next_state == EDIT_MODE)) sel_opened_edit = 1;
+	if (double_flag) Return_Home();
+	elseif (long_select_flag)
+	{
+		if ((curr_state == MENU_MODE) || sel_opened_edit) Edit_Home_Value();
+		else Cancel_Edit();
+	}
+#ENDIF
+
 	// Update Stepper Settings
-	if (next_state == MENU_MODE && curr_state == EDIT_MODE) Check_And_Store_Value();
+	if (next_state == MENU_MODE && curr_state == EDIT_MODE && !double_flag && !long_select_flag) Check_And_Store_Value();
+#IF HAS_RATE_UNITS
+	if (units_unsaved && (next_screen != HOME_PAGE)) Save_Rate_Units();
+#ENDIF
+#ENDIF
 
 	// Update Stepper State
+#IF GESTURES
+	if (prime_end_flag && priming)
+	{
+		End_Prime();
+	}
+	elseif (prime_flag && (next_state == MENU_MODE))
+	{
+		Prime_Pump();
+	}
+	elseif (start_flag && stepper_is_moving)
+#ELSE
 	if (start_flag && stepper_is_moving)
+#ENDIF
 	{
 		Stepper_Stop();
+#IF GRAV_CAL
+		End_Calibration();
+#ENDIF
 	}
 	elseif (start_flag && !stepper_is_moving && (next_state == MENU_MODE))
 	{
-		Stepper_Set_Dir();
-		Stepper_Set_Vel();
-		Stepper_Enable();
-		Stepper_Start();
-		update_display = 1;
-	}
-	if (!stepper_is_moving && stepper_enabled){
-		Stepper_Disable();
-		update_display = 1;
+#IF GRAV_CAL
+		// A press while the balance settles abandons the calibration
+		if (cal_active) End_Calibration();
+		elseif (curr_screen == UNITS_PAGE) Start_Calibration();
+		else Start_Pump();
+#ELSE
+		Start_Pump();
+#ENDIF
 	}
+	if (!stepper_is_moving && stepper_enabled) Finish_Run();
 
+#IF HAS_UI
 	// Update Display
-	if (update_display) Render_Screen();
+	if (update_display) render_pending = 1;
+#IF REDRAW_SCHED
+	if (render_pending && (next_state == MENU_MODE))
+	{
+		if (!frame_wait) Redraw();
+	}
+	elseif (render_pending && (update_display || (curr_state == MENU_MODE))) Redraw();
+	elseif (line_pending && !frame_wait) Flush_Data_Line();
+#ELSE
+	if (render_pending && ((next_state == MENU_MODE) || (curr_state == MENU_MODE) || update_display)) Redraw();
+	elseif (line_pending) Flush_Data_Line();
+#ENDIF
 	if (next_state != MENU_MODE) 
 	{
 		lcd_trx_byte = LCD_L2 + col_index;
@@ -768,12 +3072,29 @@ void Pump_State_Machine(void)
 	}
 
 	// Update Indices
+#IF TRACE
+	if (next_state != curr_state)
+	{
+		trace_event = 0x30 | next_state;
+		Trace_Event();
+	}
+	if (next_screen != curr_screen)
+	{
+		trace_event = 0x40 | next_screen;
+		Trace_Event();
+	}
+#ENDIF
 	curr_screen = next_screen;
 	curr_state  = next_state;
+#IF GESTURES
+	Update_Select_Defer();
+#ENDIF
+#ENDIF
 
 	// Clear flags
 	start_flag  = 0;
 	select_flag = 0;
 	shift_flag  = 0;
 	update_display = 0;
+	gesture_flags &= 0xF0;
 }
\ No newline at end of file
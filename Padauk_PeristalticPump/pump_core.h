@@ -1,2 +1,11 @@
+// Interrupt request bit for the input scan timer (T16, owned by pump_core)
+#DEFINE SCAN_INTR T16
+
+// Interrupt request bit for Interrupt_Src0 (PB.5, flow sensor)
+#DEFINE FLOW_INTR PA0
+
 void Pump_Initialize(void);
-void Pump_State_Machine(void);
\ No newline at end of file
+void Pump_State_Machine(void);
+void Pump_Input_Interrupt(void);
+void Pump_Step_Interrupt(void);
+void Pump_Flow_Interrupt(void);
\ No newline at end of file
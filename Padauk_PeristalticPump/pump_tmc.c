@@ -0,0 +1,153 @@
+/* pump_tmc.c
+
+This file configures a TMC2209-style stepper driver over its single-wire UART
+(write only, through the driver line of pump_uart).
+
+TMC_Configure selects register control of the driver, sets the microstep
+resolution to match stepper_steps_per_rev on a 200 full-step motor, the run and
+hold currents, and the StealthChop to SpreadCycle switching threshold.
+TMC_Write_Current updates only the run/hold current so it can follow speed
+changes cheaply.
+
+Each register write is an 8 byte datagram: sync, slave address, register with
+the write bit set, 32 data bits MSB first, then the CRC8 (x^8 + x^2 + x + 1)
+over the first 7 bytes, each taken LSB first.
+
+This software is licensed under GPLv3 <http://www.gnu.org/licenses/>.
+Any modifications or distributions have to be licensed under GPLv3.
+No warranty of any kind and copyright holders cannot be held liable.
+Licensees cannot remove copyright notices.
+
+Copyright (c) 2021 Robert R. Puccinelli
+*/
+
+#include "../Padauk-Peripherals/system_settings.h"
+#include "../Padauk-Peripherals/pdk_math.h"
+#include "../Padauk-Peripherals/pdk_stepper.h"
+#include "pump_uart.h"
+#include "pump_tmc.h"
+
+
+//====================//
+// SYSTEM DEFINITIONS //
+//====================//
+
+// Registers
+#DEFINE TMC_GCONF          0x00
+#DEFINE TMC_IHOLD_IRUN     0x10
+#DEFINE TMC_TPWMTHRS_REG   0x13
+#DEFINE TMC_CHOPCONF       0x6C
+
+// pdn_disable | mstep_reg_select | multistep_filt | I_scale_analog
+#DEFINE TMC_GCONF_VAL      0x000001C1
+
+// Reset CHOPCONF (TOFF 3, HSTRT 5, intpol) without the MRES field
+#DEFINE TMC_CHOPCONF_VAL   0x10000053
+
+
+//==================//
+// SYSTEM VARIABLES //
+//==================//
+
+BYTE  tmc_irun = 16;
+
+STATIC BYTE  tmc_reg   = 0;
+STATIC DWORD tmc_data  = 0;
+STATIC BYTE  tmc_byte  = 0;
+STATIC BYTE  tmc_crc   = 0;
+STATIC BYTE  tmc_bit   = 0;
+
+
+//==================//
+// STATIC FUNCTIONS //
+//==================//
+
+static void TMC_Send_Byte(void)
+{
+	uart_trx_byte = tmc_byte;
+
+	tmc_bit = 8;
+	while (tmc_bit--)
+	{
+		// The data bit folds into the top bit, which is then the feedback
+		if (tmc_byte.0) tmc_crc ^= 0x80;
+		if (tmc_crc.7)
+		{
+			tmc_crc <<= 1;
+			tmc_crc ^= 0x07;
+		}
+		else tmc_crc <<= 1;
+		tmc_byte >>= 1;
+	}
+
+	UART_Write_Byte();
+}
+
+
+static void TMC_Write_Reg(void)
+{
+	uart_drv_sel = 1;
+	tmc_crc = 0;
+
+	tmc_byte = 0x05;
+	TMC_Send_Byte();
+	tmc_byte = TMC_ADDR;
+	TMC_Send_Byte();
+	tmc_byte = tmc_reg | 0x80;
+	TMC_Send_Byte();
+	tmc_byte = tmc_data$3;
+	TMC_Send_Byte();
+	tmc_byte = tmc_data$2;
+	TMC_Send_Byte();
+	tmc_byte = tmc_data$1;
+	TMC_Send_Byte();
+	tmc_byte = tmc_data$0;
+	TMC_Send_Byte();
+
+	uart_trx_byte = tmc_crc;
+	UART_Write_Byte();
+	uart_drv_sel = 0;
+}
+
+
+//===================//
+// PROGRAM FUNCTIONS //
+//===================//
+
+void TMC_Configure(void)
+{
+	tmc_reg  = TMC_GCONF;
+	tmc_data = TMC_GCONF_VAL;
+	TMC_Write_Reg();
+
+	// MRES counts down from full step (8) as microsteps per full step double
+	tmc_data = TMC_CHOPCONF_VAL;
+	tmc_data$3 |= 0x08;
+	math_dividend = stepper_steps_per_rev;
+	math_divisor  = 200;
+	eword_divide();
+	while ((math_quotient > 1) && (tmc_data$3 & 0x0F))
+	{
+		math_quotient >>= 1;
+		tmc_data$3--;
+	}
+	tmc_reg = TMC_CHOPCONF;
+	TMC_Write_Reg();
+
+	tmc_reg  = TMC_TPWMTHRS_REG;
+	tmc_data = TMC_TPWMTHRS;
+	TMC_Write_Reg();
+
+	TMC_Write_Current();
+}
+
+
+void TMC_Write_Current(void)
+{
+	tmc_reg  = TMC_IHOLD_IRUN;
+	tmc_data = 0;
+	tmc_data$0 = TMC_IHOLD;
+	tmc_data$1 = tmc_irun;
+	tmc_data$2 = TMC_IHOLDDELAY;
+	TMC_Write_Reg();
+}
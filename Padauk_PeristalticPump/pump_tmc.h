@@ -0,0 +1,14 @@
+// Driver slave address (MS1/MS2 straps) and hold current, 0..31 of full scale
+#DEFINE TMC_ADDR           0
+#DEFINE TMC_IHOLD          8
+#DEFINE TMC_IHOLDDELAY     8
+
+// StealthChop below, SpreadCycle above this speed. TSTEP is the time between
+// 1/256 microsteps in 12 MHz clocks, i.e. 14062 / rpm on a 200 step motor.
+#DEFINE TMC_SWITCH_RPM     120
+#DEFINE TMC_TPWMTHRS       (14062 / TMC_SWITCH_RPM)
+
+EXTERN BYTE tmc_irun;
+
+void TMC_Configure(void);
+void TMC_Write_Current(void);
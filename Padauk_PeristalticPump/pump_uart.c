@@ -0,0 +1,125 @@
+/* pump_uart.c
+
+This file provides a half-duplex software UART (8N1) for the PMS132, used to
+talk to external instruments such as a lab balance. Setting uart_drv_sel sends
+on the separate stepper driver line instead.
+
+A byte is transferred in uart_trx_byte. Interrupts are masked only while the
+bits of a frame are being shifted so that bit timing is not disturbed; the wait
+for a start bit in UART_Read_Byte runs with interrupts enabled and gives up
+after a fixed number of polls, setting uart_timeout.
+
+UART_BIT_DELAY is one bit time minus the loop overhead in cycles. Adjust it
+together with the system clock or baud rate.
+
+This software is licensed under GPLv3 <http://www.gnu.org/licenses/>.
+Any modifications or distributions have to be licensed under GPLv3.
+No warranty of any kind and copyright holders cannot be held liable.
+Licensees cannot remove copyright notices.
+
+Copyright (c) 2021 Robert R. Puccinelli
+*/
+
+#include "pump_uart.h"
+
+
+//==================//
+// SYSTEM VARIABLES //
+//==================//
+
+BYTE  uart_trx_byte = 0;
+BYTE  uart_flags    = 0;
+BIT   uart_timeout  : uart_flags.?;
+BIT   uart_drv_sel  : uart_flags.?;
+
+STATIC BYTE  uart_bit_cnt = 0;
+STATIC WORD  uart_wait    = 0;
+
+
+//==================//
+// STATIC FUNCTIONS //
+//==================//
+
+static void UART_Set_Tx(void)
+{
+	if (uart_drv_sel)
+	{
+		if (uart_trx_byte.0) uart_drv_tx = 1;
+		else uart_drv_tx = 0;
+	}
+	else
+	{
+		if (uart_trx_byte.0) uart_tx = 1;
+		else uart_tx = 0;
+	}
+}
+
+
+//===================//
+// PROGRAM FUNCTIONS //
+//===================//
+
+void UART_Initialize(void)
+{
+	uart_tx     = 1;
+	uart_drv_tx = 1;
+	PAC.3   = 1;
+	PAC.7   = 1;
+	PAC.4   = 0;
+	PAPH.4  = 1;
+}
+
+
+void UART_Write_Byte(void)
+{
+	uart_bit_cnt = 8;
+
+	DISGINT;
+	if (uart_drv_sel) uart_drv_tx = 0;
+	else uart_tx = 0;
+	.delay UART_BIT_DELAY;
+
+	while (uart_bit_cnt--)
+	{
+		UART_Set_Tx();
+		uart_trx_byte >>= 1;
+		.delay UART_BIT_DELAY;
+	}
+
+	uart_tx     = 1;
+	uart_drv_tx = 1;
+	.delay UART_BIT_DELAY;
+	ENGINT;
+}
+
+
+void UART_Read_Byte(void)
+{
+	uart_timeout = 0;
+	uart_wait = 0xFFFF;
+
+	while (uart_rx)
+	{
+		uart_wait--;
+		if (!uart_wait)
+		{
+			uart_timeout = 1;
+			return;
+		}
+	}
+
+	DISGINT;
+	.delay UART_HALF_DELAY;
+	uart_bit_cnt = 8;
+
+	while (uart_bit_cnt--)
+	{
+		.delay UART_BIT_DELAY;
+		uart_trx_byte >>= 1;
+		if (uart_rx) uart_trx_byte.7 = 1;
+	}
+
+	// Stop bit
+	.delay UART_BIT_DELAY;
+	ENGINT;
+}
@@ -0,0 +1,16 @@
+// Software UART pins (idle high) and bit timing for 9600 baud at SYSCLK = 4 MHz.
+// uart_drv_tx is a second, transmit-only line to the stepper driver.
+#DEFINE uart_tx            PA.3
+#DEFINE uart_rx            PA.4
+#DEFINE uart_drv_tx        PA.7
+#DEFINE UART_BIT_DELAY     408
+#DEFINE UART_HALF_DELAY    204
+
+EXTERN BYTE uart_trx_byte;
+EXTERN BYTE uart_flags;
+EXTERN BIT  uart_timeout;
+EXTERN BIT  uart_drv_sel;
+
+void UART_Initialize(void);
+void UART_Write_Byte(void);
+void UART_Read_Byte(void);
@@ -0,0 +1,403 @@
+#!/usr/bin/env python3
+"""Static RAM liveness check for the pump sources.
+
+Reads the STATIC and global variables of the firmware, and the #DEFINE
+overlays that alias one of them (whole, or one byte through $n). Every
+function body is scanned for the variables it touches and the functions it
+calls; touches are closed over the call graph. Functions reachable from an
+*_Interrupt routine run in interrupt context, the rest from FPPA0.
+
+Two names overlap when they share a byte and are not the same name. Within
+each function, a value is live from a write (or a call that touches the same
+name and so hands it over) to the last read before the next write. When that
+read sits in a loop that the range starts outside of, the range covers the
+whole loop. A range is flagged when it holds
+
+  - a direct use of an overlapping name, or
+  - a call into a function that touches an overlapping name,
+
+and any byte of an overlay touched in both contexts is flagged. These are
+the failures; the run exits non-zero on any.
+
+Also listed: variables touched from both contexts (these need their main
+loop access masked or single-bit), and variables used by one function only,
+the candidates for moving onto scratch. Conditional compilation is ignored,
+so every build's code is checked at once.
+
+    python3 tools/ram_liveness.py
+"""
+
+import os
+import re
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SOURCES = ["Padauk_PeristalticPump.C", "pump_core.c", "pump_tmc.c", "pump_uart.c"]
+SIZES = {"BIT": 0, "BYTE": 1, "WORD": 2, "EWORD": 3, "DWORD": 4}
+ARRAY_DEFAULT = 16
+
+# Overlays the interrupt may write, and why that is safe
+SHARED_OVERLAYS = {
+    "stall_steps": "written only as the interrupt stops the motor; the main "
+                   "loop converts it once, clears it on every start",
+}
+
+# Ranges the path-insensitive scan cannot clear, and why they are safe
+SAFE_RANGES = {
+    ("Serial_Command", "input_data", "topup_steps"):
+        "only A writes topup_steps, and A leaves curr_screen on HOME_PAGE "
+        "so Check_And_Store_Value is skipped",
+}
+
+
+def strip(text):
+    text = re.sub(r"/\*.*?\*/", lambda m: "\n" * m.group(0).count("\n"), text, flags=re.S)
+    text = re.sub(r"//[^\n]*", "", text)
+    return re.sub(r'"(\\.|[^"\\])*"', '""', text)
+
+
+def load():
+    files = {}
+    for name in SOURCES:
+        with open(os.path.join(HERE, "..", name)) as f:
+            files[name] = strip(f.read())
+    return files
+
+
+def read_storage(files):
+    """Returns {name: (base, first byte, byte count)} for every variable.
+
+    A BIT is given the pseudo byte '.name' of its flag byte, so bits of one
+    byte do not overlap each other but do overlap the whole byte."""
+    defines, storage, bits = {}, {}, {}
+    decl = re.compile(r"^\s*(?:STATIC\s+)?(BIT|BYTE|WORD|EWORD|DWORD)\s+(\w+)"
+                      r"\s*(?:\[\s*(\w+)\s*\])?\s*(?::\s*(\w+)\.[\w?]+)?", re.M)
+    for text in files.values():
+        for m in re.finditer(r"^\s*#DEFINE\s+(\w+)\s+(\S+)", text, re.M):
+            defines[m.group(1)] = m.group(2)
+        for m in decl.finditer(text):
+            kind, name, count, flag_byte = m.groups()
+            if kind == "BIT":
+                bits[name] = flag_byte
+                continue
+            size = SIZES[kind]
+            if count:
+                count = defines.get(count, count)
+                size *= int(count, 0) if count.isdigit() else ARRAY_DEFAULT
+            storage[name] = (name, 0, size)
+    for name, flag_byte in bits.items():
+        if flag_byte in storage:
+            storage[name] = (flag_byte, "." + name, 1)
+    aliases = {}
+    for name, value in defines.items():
+        m = re.match(r"^(\w+)(?:\$(\d))?$", value)
+        if m and m.group(1) in storage and name not in storage:
+            base, offset, size = storage[m.group(1)]
+            if m.group(2) is not None:
+                offset, size = offset + int(m.group(2)), 1
+            storage[name] = (base, offset, size)
+            aliases[name] = value
+    return storage, aliases
+
+
+def cells(entry):
+    base, offset, size = entry
+    if isinstance(offset, str):
+        return {(base, offset)}
+    return {(base, offset + i) for i in range(size)}
+
+
+def overlaps(storage, a, b):
+    if a == b:
+        return False
+    ca, cb = cells(storage[a]), cells(storage[b])
+    if any(isinstance(o, str) for _, o in ca | cb):
+        # A bit overlaps only its whole flag byte
+        whole = lambda c: {x for x in c if not isinstance(x[1], str)}
+        bit_a = {x for x in ca if isinstance(x[1], str)}
+        bit_b = {x for x in cb if isinstance(x[1], str)}
+        if bit_a and bit_b:
+            return bool(bit_a & bit_b)
+        bit, other = (bit_a, whole(cb)) if bit_a else (bit_b, whole(ca))
+        base = next(iter(bit))[0]
+        return any(x[0] == base and x[1] == 0 for x in other)
+    return bool(ca & cb)
+
+
+def functions(files):
+    """Returns {name: body text} for every void f(void) definition. A function
+    defined once per build variant gets the bodies of all, one after another."""
+    found = {}
+    head = re.compile(r"^\s*(?:static\s+)?void\s+(\w+)\s*\(\s*void\s*\)\s*\{", re.M)
+    for text in files.values():
+        for m in head.finditer(text):
+            depth, i = 1, m.end()
+            while depth and i < len(text):
+                depth += {"{": 1, "}": -1}.get(text[i], 0)
+                i += 1
+            found[m.group(1)] = found.get(m.group(1), "") + text[m.end():i - 1]
+    return found
+
+
+def tokens(body, storage, funcs):
+    """(position, kind, name, access) for variable uses and calls, in order."""
+    out = []
+    for m in re.finditer(r"\b(\w+)(\$\d)?\b(\s*\()?", body):
+        name, byte, call = m.group(1), m.group(2), m.group(3)
+        if call and name in funcs:
+            out.append((m.start(), "call", name, None))
+        elif name in storage:
+            if byte:
+                name = byte_name(storage, name, int(byte[1]))
+            write = bool(re.match(r"[ \t]*=[^=]", body[m.end():m.end() + 40]))
+            out.append((m.start(), "use", name, "w" if write else "r"))
+    return out
+
+
+def byte_name(storage, name, byte):
+    """name$n as its own pseudo variable of one byte."""
+    base, offset, _ = storage[name]
+    key = "%s$%d" % (name, byte)
+    storage.setdefault(key, (base, offset + byte, 1))
+    return key
+
+
+def root(storage, aliases, name):
+    """The declared variable or overlay a name belongs to; uses of one root
+    (its bytes, its bits, the whole) are the same value, not an overlay."""
+    name = name.split("$")[0]
+    if name in aliases:
+        return name
+    base, offset, _ = storage[name]
+    return base if isinstance(offset, str) else name
+
+
+def loops(body):
+    """(start, end) of every loop, condition and body."""
+    spans = []
+    for m in re.finditer(r"\b(while|for|do)\b", body):
+        head = m.end() if m.group(1) == "do" else paren_end(body, m.start())
+        spans.append((m.start(), block_end(body, head)))
+    return spans
+
+
+def block_end(body, i):
+    """End of the statement or braced block starting at body[i]."""
+    while body[i].isspace():
+        i += 1
+    if body[i] == "{":
+        depth, i = 1, i + 1
+        while depth and i < len(body):
+            depth += {"{": 1, "}": -1}.get(body[i], 0)
+            i += 1
+        return i
+    depth = 0
+    while i < len(body) and not (body[i] == ";" and depth == 0):
+        depth += {"(": 1, ")": -1}.get(body[i], 0)
+        i += 1
+    return i + 1
+
+
+def paren_end(body, i):
+    i = body.find("(", i)
+    depth, i = 1, i + 1
+    while depth:
+        depth += {"(": 1, ")": -1}.get(body[i], 0)
+        i += 1
+    return i
+
+
+def branches(body):
+    """Groups of mutually exclusive spans: if/elseif/else chains and the
+    case segments of a switch. Code in one is never on a path through
+    another of its group."""
+    groups = []
+    for m in re.finditer(r"\bif\s*\(", body):
+        spans, i = [], m.start()
+        end = block_end(body, paren_end(body, i))
+        spans.append((i, end))
+        while True:
+            n = re.match(r"(?:\s|#[^\n]*)*(elseif\b\s*\(|else\b)", body[end:])
+            if not n:
+                break
+            start = end + n.start(1)
+            head = paren_end(body, start) if n.group(1).startswith("elseif") \
+                else start + 4
+            end = block_end(body, head)
+            spans.append((start, end))
+        if len(spans) > 1:
+            groups.append(spans)
+    for m in re.finditer(r"\bswitch\s*\(", body):
+        i = body.find("{", paren_end(body, m.start()))
+        end = block_end(body, i)
+        labels, depth = [], 0
+        for j in range(i + 1, end - 1):
+            depth += {"{": 1, "}": -1}.get(body[j], 0)
+            if depth == 0 and re.match(r"\b(case|default)\b", body[j:j + 7]) \
+                    and not body[j - 1].isalnum():
+                labels.append(j)
+        groups.append([(a, b) for a, b in zip(labels, labels[1:] + [end - 1])])
+    return groups
+
+
+def exclusive(groups, a, b):
+    for spans in groups:
+        ia = [k for k, (s, e) in enumerate(spans) if s <= a < e]
+        ib = [k for k, (s, e) in enumerate(spans) if s <= b < e]
+        if ia and ib and ia != ib:
+            return True
+    return False
+
+
+def closure(funcs, direct, calls):
+    touched = {f: set(direct[f]) for f in funcs}
+    changed = True
+    while changed:
+        changed = False
+        for f in funcs:
+            for g in calls[f]:
+                if not touched[g] <= touched[f]:
+                    touched[f] |= touched[g]
+                    changed = True
+    return touched
+
+
+def exposed_reads(funcs, rooted, touched_roots):
+    """Per function, the variables it may read before writing them."""
+    inputs = {f: set() for f in funcs}
+    changed = True
+    while changed:
+        changed = False
+        for f in funcs:
+            for n in touched_roots[f]:
+                if n in inputs[f]:
+                    continue
+                for _, kind, name, access, r in rooted[f]:
+                    if kind == "use" and r == n:
+                        exposed = access == "r"
+                    elif kind == "call" and n in touched_roots[name]:
+                        exposed = n in inputs[name]
+                    else:
+                        continue
+                    if exposed:
+                        inputs[f].add(n)
+                        changed = True
+                    break
+    return inputs
+
+
+def reach(roots, calls):
+    seen, todo = set(), list(roots)
+    while todo:
+        f = todo.pop()
+        if f not in seen:
+            seen.add(f)
+            todo.extend(calls.get(f, ()))
+    return seen
+
+
+def main():
+    files = load()
+    storage, aliases = read_storage(files)
+    funcs = functions(files)
+    toks = {f: tokens(body, storage, funcs) for f, body in funcs.items()}
+    direct = {f: {n for _, k, n, _ in t if k == "use"} for f, t in toks.items()}
+    calls = {f: {n for _, k, n, _ in t if k == "call"} for f, t in toks.items()}
+    touched = closure(funcs, direct, calls)
+
+    isr_roots = [f for f in funcs if f.endswith("_Interrupt")]
+    isr = reach(isr_roots, calls)
+    main_side = reach(["FPPA0"], calls) - reach(["Interrupt"], calls)
+    names = sorted(storage)
+    partners = {n: [p for p in names if overlaps(storage, n, p) and
+                    root(storage, aliases, p) != root(storage, aliases, n)]
+                for n in names}
+
+    rooted = {f: [(pos, kind, name, access,
+                   root(storage, aliases, name) if kind == "use" else None)
+                  for pos, kind, name, access in t] for f, t in toks.items()}
+    roots = sorted({root(storage, aliases, n) for n in names})
+    touched_roots = {f: {root(storage, aliases, n) for n in touched[f]} for f in funcs}
+    inputs = exposed_reads(funcs, rooted, touched_roots)
+    entries = set(isr_roots) | {"FPPA0", "Interrupt"}
+
+    failures = []
+    for f, body in sorted(funcs.items()):
+        loop_spans = loops(body)
+        groups = branches(body)
+        for n in roots:
+            mine = [p for p in names if root(storage, aliases, p) == n]
+            others = sorted({p for m in mine for p in partners[m]})
+            if not others or n not in touched_roots[f]:
+                continue
+            writes = []
+            for pos, kind, name, access, r in rooted[f]:
+                # A call hands the value over: it may read it, then leaves it
+                handover = kind == "call" and n in touched_roots[name]
+                if kind == "use" and r == n and access == "w":
+                    writes.append(pos + 1)
+                    continue
+                read = (kind == "use" and r == n) or (handover and n in inputs[name])
+                # The last write on a path to this read starts the range;
+                # nothing is live on entry to reset or an interrupt
+                on_path = [w for w in writes if not exclusive(groups, w - 1, pos)]
+                if read and (on_path or f not in entries):
+                    lo, hi = (on_path[-1] if on_path else 0), pos
+                    for a, b in loop_spans:
+                        if a <= pos < b and lo < a:
+                            hi = max(hi, b)
+                    for p2, k2, n2, _, _ in rooted[f]:
+                        if not lo <= p2 < hi or exclusive(groups, p2, pos):
+                            continue
+                        if k2 == "call" and n in touched_roots[n2]:
+                            continue
+                        for p in others:
+                            if not ((k2 == "use" and n2 == p) or
+                                    (k2 == "call" and p in touched[n2])):
+                                continue
+                            if (f, n, root(storage, aliases, p)) in SAFE_RANGES:
+                                continue
+                            text = "%s: %s is live across %s, which touches %s" % (
+                                f, n, n2 if k2 == "call" else "a use", p)
+                            if text not in failures:
+                                failures.append(text)
+                if handover:
+                    writes.append(pos + 1)
+
+    alias_bases = {storage[a][0] for a in aliases}
+    isr_touch = set().union(*(touched[f] for f in isr_roots)) if isr_roots else set()
+    main_touch = set().union(*(direct[f] for f in main_side))
+    whole = lambda touch: {n.split("$")[0] for n in touch}
+    shared = sorted(n for n in whole(isr_touch) & whole(main_touch) if n in storage)
+    for n in shared:
+        if storage[n][0] in alias_bases and n not in SHARED_OVERLAYS:
+            failures.append("%s (storage of an overlay) is touched by the "
+                            "interrupt and the main loop" % n)
+
+    users = {}
+    for f in funcs:
+        for n in direct[f]:
+            users.setdefault(n.split("$")[0], set()).add(f)
+    single = sorted((storage[n][2], n, next(iter(users[n]))) for n in users
+                    if len(users[n]) == 1 and n in storage and n not in aliases
+                    and "$" not in n and not isinstance(storage[n][1], str))
+
+    print("%d variables, %d overlays, %d functions (%d in interrupt context)"
+          % (len([n for n in storage if "$" not in n]), len(aliases), len(funcs),
+             len(isr)))
+    print("Overlays:")
+    for a in sorted(aliases):
+        print("  %-16s -> %s" % (a, aliases[a]))
+    print("Shared with the interrupt:")
+    print("  " + " ".join(shared))
+    print("Used by one function only:")
+    for size, n, f in single:
+        print("  %-16s %2d byte%s  %s" % (n, size, "s" if size != 1 else "", f))
+    print("%d overlap failures" % len(failures))
+    for text in failures:
+        print("  " + text)
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+"""Host reference model for Compute_Run_Steps in pump_core.c.
+
+Ports the routine operation by operation, with the peripheral math
+modelled at its real width: eword_divide takes a 24-bit dividend and a
+16-bit divisor, word_multiply takes two 16-bit operands. Any intermediate that would not fit raises an AssertionError.
+
+uL/rev is U + F/256 with the calibration trim F, scaled by Apply_Wear to
+U' = run_units and the volume to V' = V * 2^run_shift. The port is swept
+against the exact result
+
+    min(floor((2 * V' * S + U') / (2 * U')), 0xFFFFFFFF)
+
+The largest error against the rational V' * S / U' (the rounding of the
+routine itself) is reported in steps, and the largest relative error
+against V * S / (U + F/256) in ppm. The latter also covers the trim bits
+dropped when U' is cut to 16 bits. Both come with the worst settings.
+Exits non-zero on any mismatch.
+
+    python3 tools/run_steps_ref.py
+"""
+
+import random
+import sys
+from fractions import Fraction
+
+M32 = 0xFFFFFFFF
+
+
+def eword_divide(dividend, divisor):
+    assert 0 <= dividend < (1 << 24), "eword_divide dividend %#x" % dividend
+    assert 0 < divisor < (1 << 16), "eword_divide divisor %#x" % divisor
+    return divmod(dividend, divisor)
+
+
+def word_multiply(a, b):
+    assert 0 <= a < (1 << 16) and 0 <= b < (1 << 16)
+    return a * b
+
+
+def long_divide(num, divisor):
+    """Long_Divide: 32-bit by 16-bit from two eword_divide passes."""
+    q_hi, rem = eword_divide(num >> 8, divisor)
+    q_lo, rem = eword_divide((rem << 8) | (num & 0xFF), divisor)
+    assert q_lo < 256
+    return (q_hi << 8) | q_lo, rem
+
+
+def scale_units(units_rev, units_frac):
+    """Apply_Wear with no wear: uL/rev in 1/256 uL, cut down to 16 bits."""
+    long_num = (units_rev << 8) | units_frac
+    run_shift = 8
+    while long_num > 0xFFFF:
+        long_num >>= 1
+        run_shift -= 1
+    return long_num, run_shift
+
+
+def scaled_volume(volume, run_shift):
+    long_num = volume << run_shift
+    assert long_num <= M32
+    return long_num
+
+
+def run_steps(volume, steps_rev, units_rev, run_shift):
+    if not units_rev:
+        return 0
+    revs, frac = long_divide(scaled_volume(volume, run_shift), units_rev)
+
+    # Fraction of a revolution
+    long_num = (word_multiply(frac, steps_rev) + (units_rev >> 1)) & M32
+    run_steps, _ = long_divide(long_num, units_rev)
+
+    # Whole revolutions, low 16 bits
+    run_steps = (run_steps + word_multiply(revs & 0xFFFF, steps_rev)) & M32
+
+    # Whole revolutions, high 16 bits
+    product = word_multiply(revs >> 16, steps_rev)
+    if product >> 16:
+        return M32
+    high = (product & 0xFFFF) << 16
+    total = (run_steps + high) & M32
+    return M32 if total < high else total
+
+
+def reference(volume, steps_rev, units_rev, run_shift):
+    if not units_rev:
+        return 0
+    volume <<= run_shift
+    return min((2 * volume * steps_rev + units_rev) // (2 * units_rev), M32)
+
+
+def volumes(units_rev, rng):
+    edges = [0, 1, 2, units_rev >> 1, units_rev - 1, units_rev, units_rev + 1,
+             12345, 0xFFFF, 0x10000, 0x100003, 0xFFFFFF]
+    return [v for v in edges if 0 <= v <= 0xFFFFFF] + \
+        [rng.randrange(1 << 24) for _ in range(200)]
+
+
+def sweep(name, model, steps_values, rng):
+    units_values = [1, 2, 3, 7, 60, 210, 230, 800, 1700, 2800, 3800, 9999, 65535]
+    frac_values = [0, 1, 26, 128, 255]
+    cases = mismatches = 0
+    worst = (Fraction(0), None)
+    worst_rel = (Fraction(0), None)
+    for arg, steps_rev in steps_values:
+        for units_rev in units_values:
+            for units_frac in frac_values:
+                run_units, run_shift = scale_units(units_rev, units_frac)
+                exact_units = units_rev + Fraction(units_frac, 256)
+                for volume in volumes(units_rev, rng):
+                    got = model(volume, arg, run_units, run_shift)
+                    want = reference(volume, steps_rev, run_units, run_shift)
+                    cases += 1
+                    if got != want:
+                        mismatches += 1
+                        if mismatches <= 5:
+                            print("%s MISMATCH V=%d S=%d U=%d+%d/256 got=%d want=%d"
+                                  % (name, volume, steps_rev, units_rev, units_frac,
+                                     got, want))
+                        continue
+                    if got == M32:
+                        continue
+                    settings = (volume, steps_rev, units_rev, units_frac)
+                    error = abs(got - Fraction(volume << run_shift, run_units) * steps_rev)
+                    if error > worst[0]:
+                        worst = (error, settings)
+                    exact = volume * steps_rev / exact_units
+                    # Past 10^6 steps the 1/2 step rounding is below 1 ppm
+                    if exact >= 1000000:
+                        rel = abs(got - exact) / exact
+                        if rel > worst_rel[0]:
+                            worst_rel = (rel, settings)
+    print("%-8s %6d cases, %d mismatches" % (name, cases, mismatches))
+    report("  max rounding error %.6f steps" % float(worst[0]), worst[1])
+    report("  max error vs U + F/256 %.2f ppm" % float(worst_rel[0] * 10**6),
+           worst_rel[1])
+    return mismatches
+
+
+def report(text, settings):
+    if settings:
+        text += " at V=%d uL, S=%d steps/rev, U=%d+%d/256 uL/rev" % settings
+    print(text)
+
+
+def main():
+    rng = random.Random(1)
+    steps_values = [1, 200, 400, 800, 1600, 3200, 6400, 12800, 25600, 51200, 65535]
+
+    failures = sweep("run", run_steps,
+                     [(s, s) for s in steps_values], rng)
+
+    for _ in range(100000):
+        num = rng.randrange(1 << 32)
+        divisor = rng.randrange(1, 1 << 16)
+        if long_divide(num, divisor) != divmod(num, divisor):
+            print("Long_Divide MISMATCH %#x / %d" % (num, divisor))
+            failures += 1
+            break
+
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
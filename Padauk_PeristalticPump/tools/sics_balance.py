@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+"""SICS balance stand-in on a local pty, for exercising GRAV_CAL.
+
+Answers the two commands the pump sends, each terminated by CR LF:
+
+    T   tare     -> "T S      0.000 g"
+    S   stable   -> "S S     <mass> g"
+
+The mass is given in grams and printed with --decimals places. Like a real
+balance, which only answers T and S once it is stable, each reply comes
+--delay seconds after the command. --unstable replies with the dynamic
+status ("S D"), --negative sends a negative weight, and --silent never
+answers S, so each error path in Read_Balance_Mass can be triggered.
+Connect the printed pty (or --port, e.g. a USB serial adapter wired to
+PA.3/PA.4) at 9600 8N1.
+
+    python3 tools/sics_balance.py --mass 2.305
+"""
+
+import argparse
+import os
+import sys
+import termios
+import time
+import tty
+
+
+def reply(args, command):
+    if command == "T":
+        return "T S %10.*f g" % (args.decimals, 0.0)
+    if command != "S" or args.silent:
+        return None
+    mass = -args.mass if args.negative else args.mass
+    status = "D" if args.unstable else "S"
+    return "S %s %10.*f g" % (status, args.decimals, mass)
+
+
+def open_link(args):
+    if args.port:
+        fd = os.open(args.port, os.O_RDWR | os.O_NOCTTY)
+        attrs = termios.tcgetattr(fd)
+        attrs[4] = attrs[5] = termios.B9600
+        termios.tcsetattr(fd, termios.TCSANOW, attrs)
+        tty.setraw(fd)
+        print("balance on %s" % args.port)
+        return fd
+    master, slave = os.openpty()
+    tty.setraw(slave)
+    print("balance on %s" % os.ttyname(slave))
+    return master
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--mass", type=float, default=2.305, help="grams")
+    parser.add_argument("--decimals", type=int, default=3)
+    parser.add_argument("--delay", type=float, default=2.0,
+                        help="seconds before each reply")
+    parser.add_argument("--unstable", action="store_true")
+    parser.add_argument("--negative", action="store_true")
+    parser.add_argument("--silent", action="store_true")
+    parser.add_argument("--port", help="serial device instead of a pty")
+    args = parser.parse_args()
+
+    fd = open_link(args)
+    line = b""
+    while True:
+        data = os.read(fd, 64)
+        if not data:
+            return 0
+        line += data
+        while b"\n" in line:
+            raw, line = line.split(b"\n", 1)
+            command = raw.strip(b"\r ").decode("ascii", "replace")
+            answer = reply(args, command)
+            print("%-4s -> %s" % (command, answer))
+            if answer is not None:
+                time.sleep(args.delay)
+                os.write(fd, answer.encode("ascii") + b"\r\n")
+
+
+if __name__ == "__main__":
+    try:
+        sys.exit(main())
+    except KeyboardInterrupt:
+        sys.exit(0)
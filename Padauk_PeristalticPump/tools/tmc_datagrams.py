@@ -0,0 +1,248 @@
+#!/usr/bin/env python3
+"""Decoder and checker for the driver datagrams written by pump_tmc.c.
+
+Each write is sync 0x05, slave address, register | 0x80, 32 data bits MSB
+first and a CRC8 (x^8 + x^2 + x + 1) over the first 7 bytes, each taken LSB
+first. The stream is split into datagrams, the framing and CRC are checked
+and the writes are folded into a register map, which is then checked:
+
+    GCONF       pdn_disable and mstep_reg_select set, else the UART and the
+                MRES field are not in control
+    CHOPCONF    TOFF non-zero (zero disables the bridge), the base bits
+                match TMC_CHOPCONF_VAL, and MRES gives the configured
+                steps/rev on a 200 full-step motor
+    IHOLD_IRUN  IHOLD and IHOLDDELAY match pump_tmc.h, IRUN is one of
+                tmc_irun_low / tmc_irun_high from pump_core.c, IHOLD <= IRUN
+    TPWMTHRS    matches TMC_TPWMTHRS and decodes back to TMC_SWITCH_RPM
+
+The constants are read from the sources, so the checks follow them.
+
+Without arguments TMC_Configure and TMC_Write_Current are ported byte for
+byte, the stream is generated for a grid of steps/rev and both run currents,
+and each one is decoded as above. Steps/rev that are not 200 * 2^k cannot be
+set exactly; the routine truncates them to the next lower power and those
+are listed, not failed. With --capture the bytes of a real capture (hex,
+whitespace separated, e.g. a logic analyser export of the driver line) are
+decoded instead and --steps gives the steps/rev the pump was set to.
+Exits non-zero on any failed check.
+
+    python3 tools/tmc_datagrams.py
+    python3 tools/tmc_datagrams.py --capture drv.txt --steps 1600
+"""
+
+import argparse
+import os
+import re
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SOURCES = ["pump_tmc.h", "pump_tmc.c", "pump_core.c"]
+
+REG_NAMES = {0x00: "GCONF", 0x10: "IHOLD_IRUN", 0x13: "TPWMTHRS", 0x6C: "CHOPCONF"}
+SYNC = 0x05
+FULL_STEPS = 200
+TMC_CLOCK = 12000000
+
+
+def read_defines():
+    """Numeric #DEFINEs of the driver sources, later ones may use earlier."""
+    defines = {}
+    for name in SOURCES:
+        with open(os.path.join(HERE, "..", name)) as f:
+            for line in f:
+                m = re.match(r"\s*#DEFINE\s+(\w+)\s+(.+)", line)
+                if not m:
+                    continue
+                expr = m.group(2).split("//")[0].strip().replace("/", "//")
+                expr = re.sub(r"\b[A-Za-z_]\w*\b",
+                              lambda w: str(defines.get(w.group(0), w.group(0))), expr)
+                try:
+                    defines[m.group(1)] = int(eval(expr, {"__builtins__": {}}))
+                except Exception:
+                    pass
+    return defines
+
+
+def crc8(data):
+    crc = 0
+    for byte in data:
+        for _ in range(8):
+            fb = ((crc >> 7) ^ byte) & 1
+            crc = (crc << 1) & 0xFF
+            if fb:
+                crc ^= 0x07
+            byte >>= 1
+    return crc
+
+
+def write_reg(d, reg, data):
+    frame = [SYNC, d["TMC_ADDR"], reg | 0x80] + list(data.to_bytes(4, "big"))
+    return frame + [crc8(frame)]
+
+
+def chopconf_mres(steps_rev):
+    """TMC_Configure's MRES loop on the eword_divide quotient."""
+    quotient = steps_rev // FULL_STEPS
+    mres = 8
+    while quotient > 1 and mres:
+        quotient >>= 1
+        mres -= 1
+    return mres
+
+
+def configure(d, steps_rev, irun):
+    """TMC_Configure followed by TMC_Write_Current."""
+    stream = write_reg(d, d["TMC_GCONF"], d["TMC_GCONF_VAL"])
+    chop = d["TMC_CHOPCONF_VAL"] | (chopconf_mres(steps_rev) << 24)
+    stream += write_reg(d, d["TMC_CHOPCONF"], chop)
+    stream += write_reg(d, d["TMC_TPWMTHRS_REG"], d["TMC_TPWMTHRS"])
+    return stream + write_current(d, irun)
+
+
+def write_current(d, irun):
+    data = d["TMC_IHOLD"] | (irun << 8) | (d["TMC_IHOLDDELAY"] << 16)
+    return write_reg(d, d["TMC_IHOLD_IRUN"], data)
+
+
+def decode(d, stream):
+    """Splits the stream into writes; returns the register map and errors."""
+    regs, errors = {}, []
+    i = 0
+    while i < len(stream):
+        if stream[i] != SYNC:
+            errors.append("byte %d: %#04x is not a sync byte" % (i, stream[i]))
+            i += 1
+            continue
+        frame = stream[i:i + 8]
+        if len(frame) < 8:
+            errors.append("byte %d: short datagram %s" % (i, frame))
+            break
+        if crc8(frame[:7]) != frame[7]:
+            errors.append("byte %d: CRC %#04x, expected %#04x"
+                          % (i, frame[7], crc8(frame[:7])))
+        elif frame[1] != d["TMC_ADDR"]:
+            errors.append("byte %d: slave address %d" % (i, frame[1]))
+        elif not frame[2] & 0x80:
+            errors.append("byte %d: read request for %#04x" % (i, frame[2]))
+        else:
+            regs[frame[2] & 0x7F] = int.from_bytes(bytes(frame[3:7]), "big")
+        i += 8
+    return regs, errors
+
+
+def check(d, regs, steps_rev):
+    """Field checks on the register map; returns (errors, notes)."""
+    errors, notes = [], []
+    for reg in (d["TMC_GCONF"], d["TMC_CHOPCONF"], d["TMC_TPWMTHRS_REG"],
+                d["TMC_IHOLD_IRUN"]):
+        if reg not in regs:
+            errors.append("%s never written" % REG_NAMES.get(reg, hex(reg)))
+    if errors:
+        return errors, notes
+
+    gconf = regs[d["TMC_GCONF"]]
+    if not gconf & (1 << 6):
+        errors.append("GCONF %#x: pdn_disable clear" % gconf)
+    if not gconf & (1 << 7):
+        errors.append("GCONF %#x: mstep_reg_select clear, MRES ignored" % gconf)
+
+    chop = regs[d["TMC_CHOPCONF"]]
+    if not chop & 0x0F:
+        errors.append("CHOPCONF %#x: TOFF 0 disables the driver" % chop)
+    if chop & ~(0x0F << 24) != d["TMC_CHOPCONF_VAL"]:
+        errors.append("CHOPCONF %#x: base differs from %#x"
+                      % (chop, d["TMC_CHOPCONF_VAL"]))
+    mres = (chop >> 24) & 0x0F
+    if mres > 8:
+        errors.append("CHOPCONF MRES %d is reserved" % mres)
+    elif steps_rev:
+        actual = FULL_STEPS << (8 - mres)
+        if actual != steps_rev:
+            exact = steps_rev % FULL_STEPS == 0 and \
+                (steps_rev // FULL_STEPS) & (steps_rev // FULL_STEPS - 1) == 0 and \
+                steps_rev <= FULL_STEPS << 8
+            text = "steps/rev %d runs at %d (MRES %d)" % (steps_rev, actual, mres)
+            (errors if exact else notes).append(text)
+
+    current = regs[d["TMC_IHOLD_IRUN"]]
+    ihold, irun = current & 0x1F, (current >> 8) & 0x1F
+    delay = (current >> 16) & 0x0F
+    if current & ~0x0F1F1F:
+        errors.append("IHOLD_IRUN %#x: bits outside IHOLD/IRUN/IHOLDDELAY" % current)
+    if ihold != d["TMC_IHOLD"] or delay != d["TMC_IHOLDDELAY"]:
+        errors.append("IHOLD_IRUN: IHOLD %d, IHOLDDELAY %d, expected %d, %d"
+                      % (ihold, delay, d["TMC_IHOLD"], d["TMC_IHOLDDELAY"]))
+    if irun not in (d["tmc_irun_low"], d["tmc_irun_high"]):
+        errors.append("IHOLD_IRUN: IRUN %d is neither tmc_irun_low nor tmc_irun_high"
+                      % irun)
+    if ihold > irun:
+        errors.append("IHOLD_IRUN: IHOLD %d above IRUN %d" % (ihold, irun))
+
+    thrs = regs[d["TMC_TPWMTHRS_REG"]]
+    if thrs != d["TMC_TPWMTHRS"] or thrs >> 20:
+        errors.append("TPWMTHRS %d, expected %d" % (thrs, d["TMC_TPWMTHRS"]))
+    elif thrs:
+        rpm = TMC_CLOCK * 60 / (FULL_STEPS * 256 * thrs)
+        if abs(rpm - d["TMC_SWITCH_RPM"]) > d["TMC_SWITCH_RPM"] / 100:
+            errors.append("TPWMTHRS %d switches at %.1f rpm, not %d"
+                          % (thrs, rpm, d["TMC_SWITCH_RPM"]))
+    return errors, notes
+
+
+def show(regs):
+    for reg in sorted(regs):
+        print("  %-10s %#04x = %#010x" % (REG_NAMES.get(reg, "?"), reg, regs[reg]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--capture", help="file of captured bytes in hex")
+    parser.add_argument("--steps", type=int, default=0,
+                        help="steps/rev the captured pump was set to")
+    args = parser.parse_args()
+    d = read_defines()
+
+    if args.capture:
+        with open(args.capture) as f:
+            stream = [int(t, 16) for t in f.read().replace(",", " ").split()]
+        regs, errors = decode(d, stream)
+        show(regs)
+        more, notes = check(d, regs, args.steps)
+        for text in errors + more + notes:
+            print("  " + text)
+        return 1 if errors or more else 0
+
+    failures = 0
+    truncated = []
+    grid = [1, 100, 200, 300, 400, 800, 1000, 1600, 3200, 6400, 12800,
+            25600, 51200, 65535]
+    for steps_rev in grid:
+        for irun in (d["tmc_irun_low"], d["tmc_irun_high"]):
+            regs, errors = decode(d, configure(d, steps_rev, irun))
+            more, notes = check(d, regs, steps_rev)
+            truncated += [n for n in notes if n not in truncated]
+            for text in errors + more:
+                print("S=%d IRUN=%d: %s" % (steps_rev, irun, text))
+                failures += 1
+
+    # A current update on its own folds into the configured map
+    regs, _ = decode(d, configure(d, 1600, d["tmc_irun_low"]) +
+                     write_current(d, d["tmc_irun_high"]))
+    print("Register map at 1600 steps/rev after a tmc_irun_high update:")
+    show(regs)
+
+    # A corrupted byte must fail the CRC and drop the write
+    bad = write_current(d, d["tmc_irun_low"])
+    bad[4] ^= 0x01
+    if not decode(d, bad)[1]:
+        print("CRC did not catch a flipped bit")
+        failures += 1
+
+    print("%d steps/rev x 2 currents, %d failures" % (len(grid), failures))
+    for text in truncated:
+        print("  not settable: " + text)
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
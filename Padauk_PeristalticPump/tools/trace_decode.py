@@ -0,0 +1,171 @@
+#!/usr/bin/env python3
+"""Decoder for the input and state trace dumped by the serial T command.
+
+With TRACE set, pump_core.c keeps the last trace_entries events in a RAM
+ring. T replies with the trace clock at the time of the dump, then one line
+per entry, oldest first, then K:
+
+    TTTT            trace clock now (hex, ~64 ms per count)
+    TTTT EE         clock and event of one entry (0000 00 if never written)
+
+Events are 1n inputs (bit 0 start, 1 select, 2 shift, 3 shift_r), 2n
+gestures (bit 0 long select, 1 double, 2 prime, 3 prime end), 3n the new
+curr_state, 4n the new curr_screen, 50 start, 51 finish and 52 stall. The
+state and page names are read from the ENUMs in pump_core.c; the pages
+depend on the build profile, given with --profile.
+
+The 16-bit clock wraps after ~70 minutes. Each entry is unwrapped against
+the next one (the newest against the clock of the dump), so times are exact
+as long as no two neighbouring events are further apart than that. Each
+line gives the time before the dump and the time since the oldest entry.
+
+The dump is read from a file, from stdin, or with --port from the pump
+itself (T is sent, and the reply is read at 9600 8N1 until K).
+
+    python3 tools/trace_decode.py dump.txt
+    python3 tools/trace_decode.py --port /dev/ttyUSB0 --profile flow
+"""
+
+import argparse
+import os
+import re
+import sys
+import termios
+import time
+import tty
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+TICK = 0.064
+WRAP = 0x10000
+
+INPUTS = ["start", "select", "shift", "shift_r"]
+GESTURES = ["long select", "double", "prime", "prime end"]
+FIXED = {0x50: "run start", 0x51: "run finish", 0x52: "stall"}
+
+
+def read_enums():
+    """State names and the three page ENUM variants of pump_core.c."""
+    with open(os.path.join(HERE, "..", "pump_core.c")) as f:
+        text = f.read()
+    enums = [[n.strip() for n in m.group(1).split(",")]
+             for m in re.finditer(r"^ENUM\s*\{([^}]*)\}", text, re.M)]
+    states = next(e for e in enums if "MENU_MODE" in e)
+    pages = [e for e in enums if "HOME_PAGE" in e]
+    return states, pages
+
+
+def page_names(pages, profile):
+    """The variant kept by the #IF HAS_FLOW && HAS_VOLUME / HAS_VOLUME chain."""
+    has_flow = profile != "volume"
+    has_volume = profile != "flow"
+    if has_flow and has_volume:
+        return pages[0]
+    return pages[1] if has_volume else pages[2]
+
+
+def describe(event, states, pages):
+    kind, low = event >> 4, event & 0x0F
+    if event in FIXED:
+        return FIXED[event]
+    if kind in (1, 2) and low:
+        bits = INPUTS if kind == 1 else GESTURES
+        names = [bits[b] for b in range(4) if low >> b & 1]
+        return ("input " if kind == 1 else "gesture ") + " + ".join(names)
+    if kind == 3 and low < len(states):
+        return "state " + states[low]
+    if kind == 4 and low < len(pages):
+        return "screen " + pages[low]
+    return None
+
+
+def parse(lines):
+    """(clock now, [(clock, event)]) from the lines of one dump."""
+    now, entries = None, []
+    for line in lines:
+        line = line.strip()
+        if line == "K":
+            break
+        m = re.fullmatch(r"([0-9A-Fa-f]{4})(?:\s+([0-9A-Fa-f]{2}))?", line)
+        if not m:
+            continue
+        if m.group(2) is None:
+            now, entries = int(m.group(1), 16), []
+        elif now is not None:
+            entries.append((int(m.group(1), 16), int(m.group(2), 16)))
+    return now, entries
+
+
+def unwrap(now, entries):
+    """Ticks before the dump of each entry, walking back from the newest."""
+    ages, later = [], now
+    age = 0
+    for clock, _ in reversed(entries):
+        age += (later - clock) % WRAP
+        ages.append(age)
+        later = clock
+    return ages[::-1]
+
+
+def read_port(port, timeout):
+    fd = os.open(port, os.O_RDWR | os.O_NOCTTY)
+    attrs = termios.tcgetattr(fd)
+    attrs[4] = attrs[5] = termios.B9600
+    termios.tcsetattr(fd, termios.TCSANOW, attrs)
+    tty.setraw(fd)
+    termios.tcflush(fd, termios.TCIOFLUSH)
+    os.write(fd, b"T\n")
+    os.set_blocking(fd, False)
+    data, end = b"", time.time() + timeout
+    while not re.search(rb"(^|\n)K\r?\n", data) and time.time() < end:
+        try:
+            data += os.read(fd, 256)
+        except BlockingIOError:
+            time.sleep(0.05)
+    os.close(fd)
+    return data.decode("ascii", "replace").splitlines()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("dump", nargs="?", help="dump text, stdin if omitted")
+    parser.add_argument("--port", help="serial device to send T on")
+    parser.add_argument("--timeout", type=float, default=3.0,
+                        help="seconds to wait for K on --port")
+    parser.add_argument("--profile", default="full",
+                        choices=["full", "flow", "volume", "headless"])
+    args = parser.parse_args()
+
+    if args.port:
+        lines = read_port(args.port, args.timeout)
+    elif args.dump:
+        with open(args.dump) as f:
+            lines = f.read().splitlines()
+    else:
+        lines = sys.stdin.read().splitlines()
+
+    now, entries = parse(lines)
+    if now is None:
+        print("no trace clock line in the dump")
+        return 1
+    entries = [e for e in entries if e[1]]
+    if not entries:
+        print("trace ring is empty")
+        return 0
+
+    states, pages = read_enums()
+    pages = page_names(pages, args.profile)
+    ages = unwrap(now, entries)
+    unknown = 0
+    print("%d events, clock %04X at the dump" % (len(entries), now))
+    for (clock, event), age in zip(entries, ages):
+        text = describe(event, states, pages)
+        if text is None:
+            text = "unknown event"
+            unknown += 1
+        print("%9.3f s  +%8.3f s  %04X %02X  %s"
+              % (-age * TICK, (ages[0] - age) * TICK, clock, event, text))
+    return 1 if unknown else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
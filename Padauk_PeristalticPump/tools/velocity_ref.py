@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+"""Host reference model for the running rate path in pump_core.c.
+
+Steps_To_Rate turns a step rate into the uL/min cap used by Load_Field_Range
+(max_steps_per_sec), the flow trim in Service_Flow, and rx_max_rate
+(serial_max_steps). It is ported at its real widths: word_multiply is 16x16,
+Long_Divide takes 32 bits by 16. Over a grid of uL/rev and steps/rev the
+cap must never ask for more steps/s than it was given, and must stay less
+than 4 uL/min under the exact value while that fits 16 bits. Settings where
+even 1 uL/min is too fast (Load_Field_Range then still allows 1) are listed.
+
+Service_Velocity is ported with 16-bit wrap on every expression and stepped
+from each start rate to each target (edges near 0 and 0xFFFF plus a random
+sample). Each pass hands one intermediate rate to Stepper_Set_Vel; the walk
+must move toward the target by at most vel_ramp_step per pass, never leave
+the start..target range (so no intermediate rate exceeds the larger, capped
+one), and end on the target in ceil(distance / vel_ramp_step) passes.
+Stepper_Set_Vel itself, which loads the step timer, is in pdk_stepper and
+not modelled.
+
+    python3 tools/velocity_ref.py
+"""
+
+import random
+import sys
+from fractions import Fraction
+
+M16 = 0xFFFF
+M32 = 0xFFFFFFFF
+MAX_STEPS_PER_SEC = 2000
+SERIAL_MAX_STEPS = 800
+VEL_RAMP_STEP = 20
+
+
+def word_multiply(a, b):
+    assert 0 <= a <= M16 and 0 <= b <= M16, "word_multiply %d x %d" % (a, b)
+    return a * b
+
+
+def long_divide(num, divisor):
+    assert 0 <= num <= M32 and 0 < divisor <= M16
+    return divmod(num, divisor)
+
+
+def steps_to_rate(steps_sec, units_rev, steps_rev):
+    mult_b = ((steps_sec << 4) - steps_sec) & M16
+    assert mult_b == steps_sec * 15, "steps/s %d too large" % steps_sec
+    long_num, _ = long_divide(word_multiply(units_rev, mult_b), steps_rev)
+    if long_num > 0x3FFF:
+        return M16
+    return long_num << 2
+
+
+def service_velocity(applied, target):
+    """One pass; returns (vel_applied, vel_pending)."""
+    if VEL_RAMP_STEP and target > applied and ((target - applied) & M16) > VEL_RAMP_STEP:
+        return (applied + VEL_RAMP_STEP) & M16, True
+    if VEL_RAMP_STEP and applied > target and ((applied - target) & M16) > VEL_RAMP_STEP:
+        return (applied - VEL_RAMP_STEP) & M16, True
+    return target, False
+
+
+def check_caps():
+    units_values = [1, 2, 3, 7, 60, 210, 230, 800, 1700, 2800, 3800, 9999, 65535]
+    steps_values = [1, 200, 400, 800, 1000, 1600, 3200, 6400, 12800, 25600,
+                    51200, 65535]
+    failures = cases = 0
+    worst = (Fraction(0), None)
+    too_slow = []
+    for steps_sec in (MAX_STEPS_PER_SEC, SERIAL_MAX_STEPS):
+        for units_rev in units_values:
+            for steps_rev in steps_values:
+                cases += 1
+                cap = steps_to_rate(steps_sec, units_rev, steps_rev)
+                exact = Fraction(steps_sec * 60 * units_rev, steps_rev)
+                if cap > exact:
+                    print("OVER steps/s=%d U=%d S=%d cap=%d exact=%.2f"
+                          % (steps_sec, units_rev, steps_rev, cap, float(exact)))
+                    failures += 1
+                if exact < M16:
+                    error = exact - cap
+                    if error >= 4:
+                        print("LOW steps/s=%d U=%d S=%d cap=%d exact=%.2f"
+                              % (steps_sec, units_rev, steps_rev, cap, float(exact)))
+                        failures += 1
+                    if error > worst[0]:
+                        worst = (error, (steps_sec, units_rev, steps_rev))
+                if exact < 1 and steps_sec == MAX_STEPS_PER_SEC:
+                    too_slow.append((units_rev, steps_rev))
+    print("caps     %6d cases, %d failures" % (cases, failures))
+    if worst[1]:
+        print("  max shortfall %.3f uL/min at %d steps/s, U=%d uL/rev, S=%d steps/rev"
+              % ((float(worst[0]),) + worst[1]))
+    for units_rev, steps_rev in too_slow:
+        print("  1 uL/min exceeds %d steps/s at U=%d uL/rev, S=%d steps/rev"
+              % (MAX_STEPS_PER_SEC, units_rev, steps_rev))
+    return failures
+
+
+def check_ramp(rng):
+    edges = [0, 1, 2, VEL_RAMP_STEP - 1, VEL_RAMP_STEP, VEL_RAMP_STEP + 1,
+             1000, 0x7FFF, M16 - VEL_RAMP_STEP - 1, M16 - VEL_RAMP_STEP,
+             M16 - VEL_RAMP_STEP + 1, M16 - 1, M16]
+    values = edges + [rng.randrange(M16 + 1) for _ in range(150)]
+    failures = cases = passes = 0
+    for start in values:
+        for target in values:
+            cases += 1
+            low, high = min(start, target), max(start, target)
+            budget = -(-(high - low) // VEL_RAMP_STEP) if VEL_RAMP_STEP else 1
+            applied, pending, count, error = start, True, 0, None
+            while pending:
+                prev = applied
+                applied, pending = service_velocity(applied, target)
+                count += 1
+                if not low <= applied <= high:
+                    error = "left %d..%d at %d" % (low, high, applied)
+                elif abs(applied - prev) > VEL_RAMP_STEP and pending:
+                    error = "stepped %d" % (applied - prev)
+                elif abs(target - applied) > abs(target - prev):
+                    error = "moved away to %d" % applied
+                elif count > max(budget, 1):
+                    error = "no end after %d passes" % count
+                if error:
+                    break
+            passes += count
+            if not error and applied != target:
+                error = "ended on %d" % applied
+            if error:
+                failures += 1
+                if failures <= 5:
+                    print("RAMP %d -> %d: %s" % (start, target, error))
+    print("ramp     %6d cases, %d passes, %d failures" % (cases, passes, failures))
+    return failures
+
+
+def main():
+    rng = random.Random(1)
+    failures = check_caps()
+    failures += check_ramp(rng)
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())